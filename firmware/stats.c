@@ -38,5 +38,26 @@ void stats(void)
 	print_str(".");
 	stats_print_dec(((100 * num_cycles) / num_instr) % 100, 2, true);
 	print_str("\n");
+
+#ifdef PERF_COUNTERS
+	unsigned int fetch_wait, mem_wait, pcpi_wait, branches, shift, irq_wait;
+	__asm__ volatile ("csrr %0, hpmcounter3; csrr %1, hpmcounter4; csrr %2, hpmcounter5;"
+			: "=r"(fetch_wait), "=r"(mem_wait), "=r"(pcpi_wait));
+	__asm__ volatile ("csrr %0, hpmcounter6; csrr %1, hpmcounter7; csrr %2, hpmcounter8;"
+			: "=r"(branches), "=r"(shift), "=r"(irq_wait));
+	print_str("Fetch wait cycles ....");
+	stats_print_dec(fetch_wait, 8, false);
+	print_str("\nLoad/store cycles ....");
+	stats_print_dec(mem_wait, 8, false);
+	print_str("\nPCPI busy cycles .....");
+	stats_print_dec(pcpi_wait, 8, false);
+	print_str("\nTaken branches .......");
+	stats_print_dec(branches, 8, false);
+	print_str("\nShift cycles .........");
+	stats_print_dec(shift, 8, false);
+	print_str("\nIRQ wait cycles ......");
+	stats_print_dec(irq_wait, 8, false);
+	print_str("\n");
+#endif
 }
 
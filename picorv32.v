@@ -62,23 +62,36 @@
 module picorv32 #(
 	parameter [ 0:0] ENABLE_COUNTERS = 1,
 	parameter [ 0:0] ENABLE_COUNTERS64 = 1,
+	parameter [ 0:0] ENABLE_PERF_COUNTERS = 0,
 	parameter [ 0:0] ENABLE_REGS_16_31 = 1,
 	parameter [ 0:0] ENABLE_REGS_DUALPORT = 1,
 	parameter [ 0:0] LATCHED_MEM_RDATA = 0,
 	parameter [ 0:0] TWO_STAGE_SHIFT = 1,
 	parameter [ 0:0] BARREL_SHIFTER = 0,
+	parameter [ 0:0] LOG_SHIFTER = 0,
 	parameter [ 0:0] TWO_CYCLE_COMPARE = 0,
 	parameter [ 0:0] TWO_CYCLE_ALU = 0,
+	parameter [ 0:0] ENABLE_PIPELINE = 0,
+	parameter integer BRANCH_PREDICT = 0,
+	parameter integer BRANCH_PREDICT_ENTRIES = 16,
+	parameter [ 0:0] ENABLE_EARLY_LOAD = 0,
 	parameter [ 0:0] COMPRESSED_ISA = 0,
 	parameter [ 0:0] CATCH_MISALIGN = 1,
 	parameter [ 0:0] CATCH_ILLINSN = 1,
 	parameter [ 0:0] ENABLE_PCPI = 0,
+	parameter [ 0:0] PCPI_FENCE = 0,
 	parameter [ 0:0] ENABLE_MUL = 0,
+	parameter [ 0:0] MUL_EARLY_OUT = 0,
 	parameter [ 0:0] ENABLE_FAST_MUL = 0,
+	parameter [ 0:0] FAST_MUL_FUSE = 0,
 	parameter [ 0:0] ENABLE_DIV = 0,
+	parameter integer DIV_BITS_PER_CYCLE = 1,
+	parameter [ 0:0] DIV_EARLY_OUT = 0,
 	parameter [ 0:0] ENABLE_IRQ = 0,
 	parameter [ 0:0] ENABLE_IRQ_QREGS = 1,
+	parameter [ 0:0] ENABLE_IRQ_BANK = 0,
 	parameter [ 0:0] ENABLE_IRQ_TIMER = 1,
+	parameter [ 0:0] ENABLE_IRQ_VECTOR = 0,
 	parameter [ 0:0] ENABLE_TRACE = 0,
 	parameter [ 0:0] REGS_INIT_ZERO = 0,
 	parameter [31:0] MASKED_IRQ = 32'h 0000_0000,
@@ -163,30 +176,36 @@ module picorv32 #(
 	localparam integer irq_buserror = 2;
 
 	localparam integer irqregs_offset = ENABLE_REGS_16_31 ? 32 : 16;
-	localparam integer regfile_size = (ENABLE_REGS_16_31 ? 32 : 16) + 4*ENABLE_IRQ*ENABLE_IRQ_QREGS;
-	localparam integer regindex_bits = (ENABLE_REGS_16_31 ? 5 : 4) + ENABLE_IRQ*ENABLE_IRQ_QREGS;
+	localparam integer irqbank_offset = irqregs_offset + 16;
+	localparam integer regfile_size = ENABLE_IRQ && ENABLE_IRQ_BANK ? irqbank_offset + 16 : (ENABLE_REGS_16_31 ? 32 : 16) + 4*ENABLE_IRQ*ENABLE_IRQ_QREGS;
+	localparam integer regindex_bits = ENABLE_IRQ && ENABLE_IRQ_BANK ? 6 : (ENABLE_REGS_16_31 ? 5 : 4) + ENABLE_IRQ*ENABLE_IRQ_QREGS;
 
 	localparam WITH_PCPI = ENABLE_PCPI || ENABLE_MUL || ENABLE_FAST_MUL || ENABLE_DIV;
 
-	localparam [35:0] TRACE_BRANCH = {4'b 0001, 32'b 0};
-	localparam [35:0] TRACE_ADDR   = {4'b 0010, 32'b 0};
-	localparam [35:0] TRACE_IRQ    = {4'b 1000, 32'b 0};
+	localparam [35:0] TRACE_BRANCH     = {4'b 0001, 32'b 0};
+	localparam [35:0] TRACE_ADDR       = {4'b 0010, 32'b 0};
+	localparam [35:0] TRACE_MISPREDICT = {4'b 0100, 32'b 0};
+	localparam [35:0] TRACE_IRQ        = {4'b 1000, 32'b 0};
 
 	reg [63:0] count_cycle, count_instr;
-	reg [31:0] reg_pc, reg_next_pc, reg_op1, reg_op2, reg_out;
+	reg [63:0] count_fetch_wait, count_mem_wait, count_pcpi_wait, count_branch, count_shift, count_irq_wait;
+	reg [31:0] reg_pc /* verilator public */;
+	reg [31:0] reg_next_pc /* verilator public */;
+	reg [31:0] reg_op1, reg_op2, reg_out;
 	reg [4:0] reg_sh;
 
 	reg [31:0] next_insn_opcode;
 	reg [31:0] dbg_insn_opcode;
 	reg [31:0] dbg_insn_addr;
 
-	wire dbg_mem_valid = mem_valid;
+	wire dbg_mem_valid /* verilator public */ = mem_valid;
 	wire dbg_mem_instr = mem_instr;
-	wire dbg_mem_ready = mem_ready;
+	wire dbg_mem_ready /* verilator public */ = mem_ready;
 	wire [31:0] dbg_mem_addr  = mem_addr;
 	wire [31:0] dbg_mem_wdata = mem_wdata;
 	wire [ 3:0] dbg_mem_wstrb = mem_wstrb;
 	wire [31:0] dbg_mem_rdata = mem_rdata;
+	wire dbg_pcpi_valid /* verilator public */ = pcpi_valid;
 
 	assign pcpi_rs1 = reg_op1;
 	assign pcpi_rs2 = reg_op2;
@@ -197,10 +216,13 @@ module picorv32 #(
 	reg irq_active;
 	reg [31:0] irq_mask;
 	reg [31:0] irq_pending;
+	reg [31:0] irq_vector;
+	reg [31:0] irq_prio;
+	reg [4:0] irq_vector_num;
 	reg [31:0] timer;
 
 `ifndef PICORV32_REGS
-	reg [31:0] cpuregs [0:regfile_size-1];
+	reg [31:0] cpuregs [0:regfile_size-1] /* verilator public */;
 
 	integer i;
 	initial begin
@@ -270,7 +292,9 @@ module picorv32 #(
 	reg        pcpi_int_ready;
 
 	generate if (ENABLE_FAST_MUL) begin
-		picorv32_pcpi_fast_mul pcpi_mul (
+		picorv32_pcpi_fast_mul #(
+			.FUSE_MULH(FAST_MUL_FUSE)
+		) pcpi_mul (
 			.clk       (clk            ),
 			.resetn    (resetn         ),
 			.pcpi_valid(pcpi_valid     ),
@@ -283,7 +307,9 @@ module picorv32 #(
 			.pcpi_ready(pcpi_mul_ready )
 		);
 	end else if (ENABLE_MUL) begin
-		picorv32_pcpi_mul pcpi_mul (
+		picorv32_pcpi_mul #(
+			.EARLY_OUT(MUL_EARLY_OUT)
+		) pcpi_mul (
 			.clk       (clk            ),
 			.resetn    (resetn         ),
 			.pcpi_valid(pcpi_valid     ),
@@ -303,7 +329,10 @@ module picorv32 #(
 	end endgenerate
 
 	generate if (ENABLE_DIV) begin
-		picorv32_pcpi_div pcpi_div (
+		picorv32_pcpi_div #(
+			.STEPS_AT_ONCE(DIV_BITS_PER_CYCLE),
+			.EARLY_OUT    (DIV_EARLY_OUT     )
+		) pcpi_div (
 			.clk       (clk            ),
 			.resetn    (resetn         ),
 			.pcpi_valid(pcpi_valid     ),
@@ -357,9 +386,21 @@ module picorv32 #(
 	reg mem_do_rdata;
 	reg mem_do_wdata;
 
+	// with ENABLE_PIPELINE the next instruction is prefetched already in the cycle the
+	// decoder triggers, from the address following the instruction being issued (or
+	// from the branch target when BRANCH_PREDICT predicts a jump or taken branch)
+	wire mem_do_pipe_prefetch;
+	wire [31:0] mem_fetch_pc;
+	wire predict_taken;
+	wire mem_do_fetch = mem_do_prefetch || mem_do_rinst || mem_do_pipe_prefetch;
+
+	// with ENABLE_EARLY_LOAD the load address is already in reg_op1 when cpu_state_ldmem
+	// is entered, and the load is issued in the cycle the instruction prefetch completes
+	wire mem_la_early_rdata;
+
 	wire mem_xfer;
 	reg mem_la_secondword, mem_la_firstword_reg, last_mem_valid;
-	wire mem_la_firstword = COMPRESSED_ISA && (mem_do_prefetch || mem_do_rinst) && next_pc[1] && !mem_la_secondword;
+	wire mem_la_firstword = COMPRESSED_ISA && mem_do_fetch && mem_fetch_pc[1] && !mem_la_secondword;
 	wire mem_la_firstword_xfer = COMPRESSED_ISA && mem_xfer && (!last_mem_valid ? mem_la_firstword : mem_la_firstword_reg);
 
 	reg prefetched_high_word;
@@ -377,9 +418,10 @@ module picorv32 #(
 			(!mem_la_firstword || (~&mem_rdata_latched[1:0] && mem_xfer));
 
 	assign mem_la_write = resetn && !mem_state && mem_do_wdata;
-	assign mem_la_read = resetn && ((!mem_la_use_prefetched_high_word && !mem_state && (mem_do_rinst || mem_do_prefetch || mem_do_rdata)) ||
-			(COMPRESSED_ISA && mem_xfer && (!last_mem_valid ? mem_la_firstword : mem_la_firstword_reg) && !mem_la_secondword && &mem_rdata_latched[1:0]));
-	assign mem_la_addr = (mem_do_prefetch || mem_do_rinst) ? {next_pc[31:2] + mem_la_firstword_xfer, 2'b00} : {reg_op1[31:2], 2'b00};
+	assign mem_la_read = resetn && ((!mem_la_use_prefetched_high_word && !mem_state && (mem_do_fetch || mem_do_rdata)) ||
+			(COMPRESSED_ISA && mem_xfer && (!last_mem_valid ? mem_la_firstword : mem_la_firstword_reg) && !mem_la_secondword && &mem_rdata_latched[1:0]) ||
+			mem_la_early_rdata);
+	assign mem_la_addr = mem_do_fetch && !mem_la_early_rdata ? {mem_fetch_pc[31:2] + mem_la_firstword_xfer, 2'b00} : {reg_op1[31:2], 2'b00};
 
 	assign mem_rdata_latched_noshuffle = (mem_xfer || LATCHED_MEM_RDATA) ? mem_rdata : mem_rdata_q;
 
@@ -580,9 +622,9 @@ module picorv32 #(
 			end
 			case (mem_state)
 				0: begin
-					if (mem_do_prefetch || mem_do_rinst || mem_do_rdata) begin
+					if (mem_do_fetch || mem_do_rdata) begin
 						mem_valid <= !mem_la_use_prefetched_high_word;
-						mem_instr <= mem_do_prefetch || mem_do_rinst;
+						mem_instr <= mem_do_fetch;
 						mem_wstrb <= 0;
 						mem_state <= 1;
 					end
@@ -598,7 +640,7 @@ module picorv32 #(
 					`assert(mem_valid == !mem_la_use_prefetched_high_word);
 					`assert(mem_instr == (mem_do_prefetch || mem_do_rinst));
 					if (mem_xfer) begin
-						if (COMPRESSED_ISA && mem_la_read) begin
+						if (COMPRESSED_ISA && mem_la_read && !mem_la_early_rdata) begin
 							mem_valid <= 1;
 							mem_la_secondword <= 1;
 							if (!mem_la_use_prefetched_high_word)
@@ -634,6 +676,12 @@ module picorv32 #(
 					end
 				end
 			endcase
+
+			if (mem_la_early_rdata) begin
+				mem_valid <= 1;
+				mem_instr <= 0;
+				mem_state <= 1;
+			end
 		end
 
 		if (clear_prefetched_high_word)
@@ -649,7 +697,9 @@ module picorv32 #(
 	reg instr_addi, instr_slti, instr_sltiu, instr_xori, instr_ori, instr_andi, instr_slli, instr_srli, instr_srai;
 	reg instr_add, instr_sub, instr_sll, instr_slt, instr_sltu, instr_xor, instr_srl, instr_sra, instr_or, instr_and;
 	reg instr_rdcycle, instr_rdcycleh, instr_rdinstr, instr_rdinstrh, instr_ecall_ebreak, instr_fence;
-	reg instr_getq, instr_setq, instr_retirq, instr_maskirq, instr_waitirq, instr_timer;
+	reg instr_rdhpm, instr_rdhpmh;
+	reg [3:0] decoded_hpm;
+	reg instr_getq, instr_setq, instr_retirq, instr_maskirq, instr_waitirq, instr_timer, instr_irqvec, instr_irqprio;
 	wire instr_trap;
 
 	reg [regindex_bits-1:0] decoded_rd, decoded_rs1;
@@ -681,8 +731,8 @@ module picorv32 #(
 			instr_lb, instr_lh, instr_lw, instr_lbu, instr_lhu, instr_sb, instr_sh, instr_sw,
 			instr_addi, instr_slti, instr_sltiu, instr_xori, instr_ori, instr_andi, instr_slli, instr_srli, instr_srai,
 			instr_add, instr_sub, instr_sll, instr_slt, instr_sltu, instr_xor, instr_srl, instr_sra, instr_or, instr_and,
-			instr_rdcycle, instr_rdcycleh, instr_rdinstr, instr_rdinstrh, instr_fence,
-			instr_getq, instr_setq, instr_retirq, instr_maskirq, instr_waitirq, instr_timer};
+			instr_rdcycle, instr_rdcycleh, instr_rdinstr, instr_rdinstrh, instr_rdhpm, instr_rdhpmh, instr_fence && !(ENABLE_PCPI && PCPI_FENCE),
+			instr_getq, instr_setq, instr_retirq, instr_maskirq, instr_waitirq, instr_timer, instr_irqvec, instr_irqprio};
 
 	wire is_rdcycle_rdcycleh_rdinstr_rdinstrh;
 	assign is_rdcycle_rdcycleh_rdinstr_rdinstrh = |{instr_rdcycle, instr_rdcycleh, instr_rdinstr, instr_rdinstrh};
@@ -747,6 +797,8 @@ module picorv32 #(
 		if (instr_rdcycleh) new_ascii_instr = "rdcycleh";
 		if (instr_rdinstr)  new_ascii_instr = "rdinstr";
 		if (instr_rdinstrh) new_ascii_instr = "rdinstrh";
+		if (instr_rdhpm)    new_ascii_instr = "rdhpm";
+		if (instr_rdhpmh)   new_ascii_instr = "rdhpmh";
 		if (instr_fence)    new_ascii_instr = "fence";
 
 		if (instr_getq)     new_ascii_instr = "getq";
@@ -755,6 +807,8 @@ module picorv32 #(
 		if (instr_maskirq)  new_ascii_instr = "maskirq";
 		if (instr_waitirq)  new_ascii_instr = "waitirq";
 		if (instr_timer)    new_ascii_instr = "timer";
+		if (instr_irqvec)   new_ascii_instr = "irqvec";
+		if (instr_irqprio)  new_ascii_instr = "irqprio";
 	end
 
 	reg [63:0] q_ascii_instr;
@@ -884,7 +938,7 @@ module picorv32 #(
 			decoded_rs2 <= mem_rdata_latched[24:20];
 
 			if (mem_rdata_latched[6:0] == 7'b0001011 && mem_rdata_latched[31:25] == 7'b0000000 && ENABLE_IRQ && ENABLE_IRQ_QREGS)
-				decoded_rs1[regindex_bits-1] <= 1; // instr_getq
+				decoded_rs1 <= irqregs_offset | mem_rdata_latched[16:15]; // instr_getq
 
 			if (mem_rdata_latched[6:0] == 7'b0001011 && mem_rdata_latched[31:25] == 7'b0000010 && ENABLE_IRQ)
 				decoded_rs1 <= ENABLE_IRQ_QREGS ? irqregs_offset : 3; // instr_retirq
@@ -1083,6 +1137,13 @@ module picorv32 #(
 			instr_rdinstr  <=  (mem_rdata_q[6:0] == 7'b1110011 && mem_rdata_q[31:12] == 'b11000000001000000010) && ENABLE_COUNTERS;
 			instr_rdinstrh <=  (mem_rdata_q[6:0] == 7'b1110011 && mem_rdata_q[31:12] == 'b11001000001000000010) && ENABLE_COUNTERS && ENABLE_COUNTERS64;
 
+			// hpmcounter3 .. hpmcounter8 (and their upper halves)
+			instr_rdhpm  <= mem_rdata_q[6:0] == 7'b1110011 && mem_rdata_q[31:24] == 8'hc0 && mem_rdata_q[23:20] >= 3 && mem_rdata_q[23:20] <= 8 &&
+					mem_rdata_q[19:12] == 8'b00000010 && ENABLE_PERF_COUNTERS;
+			instr_rdhpmh <= mem_rdata_q[6:0] == 7'b1110011 && mem_rdata_q[31:24] == 8'hc8 && mem_rdata_q[23:20] >= 3 && mem_rdata_q[23:20] <= 8 &&
+					mem_rdata_q[19:12] == 8'b00000010 && ENABLE_PERF_COUNTERS && ENABLE_COUNTERS64;
+			decoded_hpm <= mem_rdata_q[23:20];
+
 			instr_ecall_ebreak <= ((mem_rdata_q[6:0] == 7'b1110011 && !mem_rdata_q[31:21] && !mem_rdata_q[19:7]) ||
 					(COMPRESSED_ISA && mem_rdata_q[15:0] == 16'h9002));
 			instr_fence <= (mem_rdata_q[6:0] == 7'b0001111 && !mem_rdata_q[14:12]);
@@ -1091,6 +1152,8 @@ module picorv32 #(
 			instr_setq    <= mem_rdata_q[6:0] == 7'b0001011 && mem_rdata_q[31:25] == 7'b0000001 && ENABLE_IRQ && ENABLE_IRQ_QREGS;
 			instr_maskirq <= mem_rdata_q[6:0] == 7'b0001011 && mem_rdata_q[31:25] == 7'b0000011 && ENABLE_IRQ;
 			instr_timer   <= mem_rdata_q[6:0] == 7'b0001011 && mem_rdata_q[31:25] == 7'b0000101 && ENABLE_IRQ && ENABLE_IRQ_TIMER;
+			instr_irqvec  <= mem_rdata_q[6:0] == 7'b0001011 && mem_rdata_q[31:25] == 7'b0000111 && ENABLE_IRQ && ENABLE_IRQ_VECTOR;
+			instr_irqprio <= mem_rdata_q[6:0] == 7'b0001011 && mem_rdata_q[31:25] == 7'b0001000 && ENABLE_IRQ && ENABLE_IRQ_VECTOR;
 
 			is_slli_srli_srai <= is_alu_reg_imm && |{
 				mem_rdata_q[14:12] == 3'b001 && mem_rdata_q[31:25] == 7'b0000000,
@@ -1116,6 +1179,23 @@ module picorv32 #(
 			is_lui_auipc_jal_jalr_addi_add_sub <= 0;
 			is_compare <= 0;
 
+			if (ENABLE_PIPELINE) begin
+				// instructions issued straight from cpu_state_fetch are already in cpu_state_exec
+				// in the next cycle, so the ALU select signals can't wait for instr_* to be decoded
+				is_lui_auipc_jal_jalr_addi_add_sub <= |{instr_lui, instr_auipc, instr_jal, instr_jalr} ||
+						(is_alu_reg_imm && mem_rdata_q[14:12] == 3'b000) ||
+						(is_alu_reg_reg && mem_rdata_q[14:12] == 3'b000 && (mem_rdata_q[31:25] == 7'b0000000 || mem_rdata_q[31:25] == 7'b0100000));
+				is_slti_blt_slt <= (is_alu_reg_imm && mem_rdata_q[14:12] == 3'b010) ||
+						(is_beq_bne_blt_bge_bltu_bgeu && mem_rdata_q[14:12] == 3'b100) ||
+						(is_alu_reg_reg && mem_rdata_q[14:12] == 3'b010 && mem_rdata_q[31:25] == 7'b0000000);
+				is_sltiu_bltu_sltu <= (is_alu_reg_imm && mem_rdata_q[14:12] == 3'b011) ||
+						(is_beq_bne_blt_bge_bltu_bgeu && mem_rdata_q[14:12] == 3'b110) ||
+						(is_alu_reg_reg && mem_rdata_q[14:12] == 3'b011 && mem_rdata_q[31:25] == 7'b0000000);
+				is_compare <= is_beq_bne_blt_bge_bltu_bgeu ||
+						(is_alu_reg_imm && (mem_rdata_q[14:12] == 3'b010 || mem_rdata_q[14:12] == 3'b011)) ||
+						(is_alu_reg_reg && (mem_rdata_q[14:12] == 3'b010 || mem_rdata_q[14:12] == 3'b011) && mem_rdata_q[31:25] == 7'b0000000);
+			end
+
 			(* parallel_case *)
 			case (1'b1)
 				instr_jal:
@@ -1178,7 +1258,10 @@ module picorv32 #(
 	localparam cpu_state_stmem  = 8'b00000010;
 	localparam cpu_state_ldmem  = 8'b00000001;
 
-	reg [7:0] cpu_state;
+	reg [7:0] cpu_state /* verilator public */;
+
+	assign mem_la_early_rdata = ENABLE_EARLY_LOAD && cpu_state == cpu_state_ldmem && !mem_do_rdata && mem_do_rinst && mem_done;
+
 	reg [1:0] irq_state;
 
 	`FORMAL_KEEP reg [127:0] dbg_ascii_state;
@@ -1202,6 +1285,8 @@ module picorv32 #(
 	reg latched_store;
 	reg latched_stalu;
 	reg latched_branch;
+	reg latched_predict;
+	reg latched_mispredict;
 	reg latched_compr;
 	reg latched_trace;
 	reg latched_is_lu;
@@ -1218,6 +1303,25 @@ module picorv32 #(
 	reg [31:0] next_irq_pending;
 	reg do_waitirq;
 
+	// ENABLE_IRQ_VECTOR: with irq_vector[0] set, only one IRQ is entered at a time, at
+	// irq_vector[31:7] + 4*irq_vector_num. It is the lowest numbered pending unmasked IRQ
+	// that is set in irq_prio, or the lowest numbered one if none of those is pending.
+	wire irq_vectored = ENABLE_IRQ && ENABLE_IRQ_VECTOR && irq_vector[0];
+	wire [31:0] irq_vector_bit = 32'b1 << irq_vector_num;
+	reg [31:0] irq_vector_ready;
+	reg [4:0] irq_vector_next;
+	integer irq_vector_i;
+
+	always @* begin
+		irq_vector_ready = irq_pending & ~irq_mask;
+		if (|(irq_vector_ready & irq_prio))
+			irq_vector_ready = irq_vector_ready & irq_prio;
+		irq_vector_next = 0;
+		for (irq_vector_i = 31; irq_vector_i >= 0; irq_vector_i = irq_vector_i-1)
+			if (irq_vector_ready[irq_vector_i])
+				irq_vector_next = irq_vector_i;
+	end
+
 	reg [31:0] alu_out, alu_out_q;
 	reg alu_out_0, alu_out_0_q;
 	reg alu_wait, alu_wait_2;
@@ -1289,6 +1393,22 @@ module picorv32 #(
 `endif
 	end
 
+	// LOG_SHIFTER: shift by up to 15 bits per cycle through the four smaller stages of a
+	// right barrel shifter (by 1, 2, 4 and 8). Left shifts reverse the bit order before and
+	// after these stages, so that left and right shifts share one datapath.
+	reg [31:0] log_shift_in, log_shift_stages, log_shift_out;
+	reg [3:0] log_shift_amount;
+	integer log_shift_i;
+
+	always @* begin
+		log_shift_amount = reg_sh[4] ? 15 : reg_sh[3:0];
+		for (log_shift_i = 0; log_shift_i < 32; log_shift_i = log_shift_i+1)
+			log_shift_in[log_shift_i] = instr_sll || instr_slli ? reg_op1[31-log_shift_i] : reg_op1[log_shift_i];
+		log_shift_stages = $signed({instr_sra || instr_srai ? reg_op1[31] : 1'b0, log_shift_in}) >>> log_shift_amount;
+		for (log_shift_i = 0; log_shift_i < 32; log_shift_i = log_shift_i+1)
+			log_shift_out[log_shift_i] = instr_sll || instr_slli ? log_shift_stages[31-log_shift_i] : log_shift_stages[log_shift_i];
+	end
+
 	reg clear_prefetched_high_word_q;
 	always @(posedge clk) clear_prefetched_high_word_q <= clear_prefetched_high_word;
 
@@ -1296,7 +1416,7 @@ module picorv32 #(
 		clear_prefetched_high_word = clear_prefetched_high_word_q;
 		if (!prefetched_high_word)
 			clear_prefetched_high_word = 0;
-		if (latched_branch || irq_state || !resetn)
+		if (latched_branch || latched_mispredict || (mem_do_pipe_prefetch && predict_taken) || irq_state || !resetn)
 			clear_prefetched_high_word = COMPRESSED_ISA;
 	end
 
@@ -1306,6 +1426,18 @@ module picorv32 #(
 	reg [31:0] cpuregs_rs2;
 	reg [regindex_bits-1:0] decoded_rs;
 
+	// ENABLE_IRQ_BANK: while irq_active, x1..x15 are a second bank at irqbank_offset, so
+	// IRQ entry and retirq switch register sets without saving anything to memory. The
+	// write of the return address/IRQ bits (x3/x4 without ENABLE_IRQ_QREGS) in the cycle
+	// that sets irq_active already goes to the IRQ bank.
+	wire irq_bank_rd = ENABLE_IRQ && ENABLE_IRQ_BANK && irq_active;
+	wire irq_bank_wr = ENABLE_IRQ && ENABLE_IRQ_BANK && (irq_active || irq_state[0]);
+
+	wire [regindex_bits-1:0] cpuregs_wridx  = irq_bank_wr && latched_rd  < 16 ? irqbank_offset | latched_rd  : latched_rd;
+	wire [regindex_bits-1:0] cpuregs_rdidx1 = irq_bank_rd && decoded_rs1 < 16 ? irqbank_offset | decoded_rs1 : decoded_rs1;
+	wire [regindex_bits-1:0] cpuregs_rdidx2 = irq_bank_rd && decoded_rs2 < 16 ? irqbank_offset | decoded_rs2 : decoded_rs2;
+	wire [regindex_bits-1:0] cpuregs_rdidx  = irq_bank_rd && decoded_rs  < 16 ? irqbank_offset | decoded_rs  : decoded_rs;
+
 	always @* begin
 		cpuregs_write = 0;
 		cpuregs_wrdata = 'bx;
@@ -1326,7 +1458,7 @@ module picorv32 #(
 					cpuregs_write = 1;
 				end
 				ENABLE_IRQ && irq_state[1]: begin
-					cpuregs_wrdata = irq_pending & ~irq_mask;
+					cpuregs_wrdata = irq_vectored ? irq_vector_bit : irq_pending & ~irq_mask;
 					cpuregs_write = 1;
 				end
 			endcase
@@ -1337,11 +1469,11 @@ module picorv32 #(
 	always @(posedge clk) begin
 		if (resetn && cpuregs_write && latched_rd)
 `ifdef PICORV32_TESTBUG_001
-			cpuregs[latched_rd ^ 1] <= cpuregs_wrdata;
+			cpuregs[cpuregs_wridx ^ 1] <= cpuregs_wrdata;
 `elsif PICORV32_TESTBUG_002
-			cpuregs[latched_rd] <= cpuregs_wrdata ^ 1;
+			cpuregs[cpuregs_wridx] <= cpuregs_wrdata ^ 1;
 `else
-			cpuregs[latched_rd] <= cpuregs_wrdata;
+			cpuregs[cpuregs_wridx] <= cpuregs_wrdata;
 `endif
 	end
 
@@ -1349,8 +1481,8 @@ module picorv32 #(
 		decoded_rs = 'bx;
 		if (ENABLE_REGS_DUALPORT) begin
 `ifndef RISCV_FORMAL_BLACKBOX_REGS
-			cpuregs_rs1 = decoded_rs1 ? cpuregs[decoded_rs1] : 0;
-			cpuregs_rs2 = decoded_rs2 ? cpuregs[decoded_rs2] : 0;
+			cpuregs_rs1 = decoded_rs1 ? cpuregs[cpuregs_rdidx1] : 0;
+			cpuregs_rs2 = decoded_rs2 ? cpuregs[cpuregs_rdidx2] : 0;
 `else
 			cpuregs_rs1 = decoded_rs1 ? $anyseq : 0;
 			cpuregs_rs2 = decoded_rs2 ? $anyseq : 0;
@@ -1358,7 +1490,7 @@ module picorv32 #(
 		end else begin
 			decoded_rs = (cpu_state == cpu_state_ld_rs2) ? decoded_rs2 : decoded_rs1;
 `ifndef RISCV_FORMAL_BLACKBOX_REGS
-			cpuregs_rs1 = decoded_rs ? cpuregs[decoded_rs] : 0;
+			cpuregs_rs1 = decoded_rs ? cpuregs[cpuregs_rdidx] : 0;
 `else
 			cpuregs_rs1 = decoded_rs ? $anyseq : 0;
 `endif
@@ -1369,9 +1501,9 @@ module picorv32 #(
 	wire[31:0] cpuregs_rdata1;
 	wire[31:0] cpuregs_rdata2;
 
-	wire [5:0] cpuregs_waddr = latched_rd;
-	wire [5:0] cpuregs_raddr1 = ENABLE_REGS_DUALPORT ? decoded_rs1 : decoded_rs;
-	wire [5:0] cpuregs_raddr2 = ENABLE_REGS_DUALPORT ? decoded_rs2 : 0;
+	wire [5:0] cpuregs_waddr = cpuregs_wridx;
+	wire [5:0] cpuregs_raddr1 = ENABLE_REGS_DUALPORT ? cpuregs_rdidx1 : cpuregs_rdidx;
+	wire [5:0] cpuregs_raddr2 = ENABLE_REGS_DUALPORT ? cpuregs_rdidx2 : 0;
 
 	`PICORV32_REGS cpuregs (
 		.clk(clk),
@@ -1399,6 +1531,142 @@ module picorv32 #(
 
 	assign launch_next_insn = cpu_state == cpu_state_fetch && decoder_trigger && (!ENABLE_IRQ || irq_delay || irq_active || !(irq_pending & ~irq_mask));
 
+	// ENABLE_PIPELINE: ALU, shift, branch, store and jalr instructions (and loads with
+	// ENABLE_EARLY_LOAD) read their operands in the cycle the decoder triggers and go from
+	// cpu_state_fetch straight to cpu_state_exec (or cpu_state_shift, cpu_state_stmem,
+	// cpu_state_ldmem). The value written back in the same cycle, which also is the result
+	// of a preceding load, is forwarded. Instructions that read rs2 only take this path with
+	// ENABLE_REGS_DUALPORT. After a load or store (decoder_pseudo_trigger) mem_rdata_q no
+	// longer holds the instruction, but then instr_* and decoded_imm are already valid.
+	// This is an operand-read shortcut, not a pipeline: there still is only one instruction
+	// in flight, and the next one is decoded after this one has finished executing.
+
+	// BRANCH_PREDICT: jal, and conditional branches that are predicted taken, start the
+	// fetch from the branch target in the cycle the decoder triggers (also without
+	// ENABLE_PIPELINE). Mode 1 predicts backward branches taken and forward branches not
+	// taken, mode 2 uses a table of 2-bit counters indexed by the branch address and
+	// falls back to the static prediction for entries that have not been trained yet.
+	// A mispredicted branch refetches from the correct address in cpu_state_exec and
+	// sets TRACE_MISPREDICT in its trace record.
+
+	localparam integer bht_bits = BRANCH_PREDICT_ENTRIES > 1 ? $clog2(BRANCH_PREDICT_ENTRIES) : 1;
+
+	reg [1:0] bht_count [0:2**bht_bits-1];
+	reg [2**bht_bits-1:0] bht_valid;
+
+	wire [31:0] predict_imm_b = $signed({mem_rdata_q[31], mem_rdata_q[7], mem_rdata_q[30:25], mem_rdata_q[11:8], 1'b0});
+	wire [31:0] predict_imm = instr_jal ? decoded_imm_j : decoder_pseudo_trigger ? decoded_imm : predict_imm_b;
+	wire [31:0] predict_pc = next_pc + predict_imm;
+	wire [bht_bits-1:0] predict_index = COMPRESSED_ISA ? next_pc[bht_bits:1] : next_pc[bht_bits+1:2];
+	wire [bht_bits-1:0] resolve_index = COMPRESSED_ISA ? reg_pc[bht_bits:1] : reg_pc[bht_bits+1:2];
+
+	assign predict_taken = BRANCH_PREDICT && (COMPRESSED_ISA || !CATCH_MISALIGN || !predict_pc[1]) && (instr_jal ||
+			(is_beq_bne_blt_bge_bltu_bgeu && (BRANCH_PREDICT == 2 && bht_valid[predict_index] ? bht_count[predict_index][1] : predict_imm[31])));
+
+	assign mem_do_pipe_prefetch = launch_next_insn && !irq_state && !instr_jalr && !instr_retirq && !instr_waitirq &&
+			((ENABLE_PIPELINE && !instr_jal) || predict_taken);
+	assign mem_fetch_pc = !mem_do_pipe_prefetch ? next_pc : predict_taken ? predict_pc : next_pc + (compressed_instr ? 2 : 4);
+
+	reg pipe_alu_imm, pipe_alu_reg, pipe_shift_imm, pipe_shift_reg, pipe_branch, pipe_store, pipe_load;
+	reg [31:0] pipe_imm;
+
+	wire pipe_lui_auipc = instr_lui || instr_auipc;
+	wire pipe_jalr = instr_jalr;
+	wire pipe_read_rs2 = |{pipe_alu_reg, pipe_shift_reg, pipe_branch, pipe_store};
+	wire [31:0] pipe_rs1 = cpuregs_write && latched_rd && latched_rd == decoded_rs1 ? cpuregs_wrdata : cpuregs_rs1;
+	wire [31:0] pipe_rs2 = cpuregs_write && latched_rd && latched_rd == decoded_rs2 ? cpuregs_wrdata : cpuregs_rs2;
+
+	always @* begin
+		if (decoder_pseudo_trigger) begin
+			pipe_alu_imm = |{instr_addi, instr_slti, instr_sltiu, instr_xori, instr_ori, instr_andi};
+			pipe_shift_imm = is_slli_srli_srai;
+			pipe_alu_reg = |{instr_add, instr_sub, instr_slt, instr_sltu, instr_xor, instr_or, instr_and};
+			pipe_shift_reg = is_sll_srl_sra;
+			pipe_branch = |{instr_beq, instr_bne, instr_blt, instr_bge, instr_bltu, instr_bgeu};
+			pipe_store = |{instr_sb, instr_sh, instr_sw};
+			pipe_load = |{instr_lb, instr_lh, instr_lw, instr_lbu, instr_lhu};
+			pipe_imm = decoded_imm;
+		end else begin
+			pipe_alu_imm = is_alu_reg_imm && mem_rdata_q[14:12] != 3'b001 && mem_rdata_q[14:12] != 3'b101;
+			pipe_shift_imm = is_alu_reg_imm && |{
+				mem_rdata_q[14:12] == 3'b001 && mem_rdata_q[31:25] == 7'b0000000,
+				mem_rdata_q[14:12] == 3'b101 && mem_rdata_q[31:25] == 7'b0000000,
+				mem_rdata_q[14:12] == 3'b101 && mem_rdata_q[31:25] == 7'b0100000
+			};
+			pipe_alu_reg = is_alu_reg_reg && |{
+				mem_rdata_q[14:12] == 3'b000 && mem_rdata_q[31:25] == 7'b0100000,
+				mem_rdata_q[14:12] != 3'b001 && mem_rdata_q[14:12] != 3'b101 && mem_rdata_q[31:25] == 7'b0000000
+			};
+			pipe_shift_reg = is_alu_reg_reg && |{
+				mem_rdata_q[14:12] == 3'b001 && mem_rdata_q[31:25] == 7'b0000000,
+				mem_rdata_q[14:12] == 3'b101 && mem_rdata_q[31:25] == 7'b0000000,
+				mem_rdata_q[14:12] == 3'b101 && mem_rdata_q[31:25] == 7'b0100000
+			};
+			pipe_branch = is_beq_bne_blt_bge_bltu_bgeu && mem_rdata_q[14:12] != 3'b010 && mem_rdata_q[14:12] != 3'b011;
+			pipe_store = is_sb_sh_sw && !mem_rdata_q[14] && mem_rdata_q[13:12] != 2'b11;
+			pipe_load = is_lb_lh_lw_lbu_lhu && mem_rdata_q[14:12] != 3'b011 && mem_rdata_q[14:12] != 3'b110 && mem_rdata_q[14:12] != 3'b111;
+			pipe_imm = $signed(mem_rdata_q[31:20]);
+			if (pipe_lui_auipc)
+				pipe_imm = mem_rdata_q[31:12] << 12;
+		end
+		if (!ENABLE_REGS_DUALPORT) begin
+			pipe_alu_reg = 0;
+			pipe_shift_reg = 0;
+			pipe_branch = 0;
+			pipe_store = 0;
+		end
+		if (!ENABLE_EARLY_LOAD)
+			pipe_load = 0;
+	end
+
+	// Performance counters, read as hpmcounter3 .. hpmcounter8
+	reg [63:0] count_perf;
+
+	always @* begin
+		case (decoded_hpm)
+			3: count_perf = count_fetch_wait;
+			4: count_perf = count_mem_wait;
+			5: count_perf = count_pcpi_wait;
+			6: count_perf = count_branch;
+			7: count_perf = count_shift;
+			8: count_perf = count_irq_wait;
+			default: count_perf = 'bx;
+		endcase
+	end
+
+	always @(posedge clk) begin
+		if (ENABLE_PERF_COUNTERS && resetn) begin
+			if (cpu_state == cpu_state_fetch && !decoder_trigger && !do_waitirq)
+				count_fetch_wait <= count_fetch_wait + 1;
+			if (cpu_state == cpu_state_ldmem || cpu_state == cpu_state_stmem)
+				count_mem_wait <= count_mem_wait + 1;
+			if (pcpi_valid)
+				count_pcpi_wait <= count_pcpi_wait + 1;
+			if (cpu_state == cpu_state_exec && is_beq_bne_blt_bge_bltu_bgeu && mem_done && (TWO_CYCLE_COMPARE ? alu_out_0_q : alu_out_0) &&
+					!((TWO_CYCLE_ALU || TWO_CYCLE_COMPARE) && (alu_wait || alu_wait_2)))
+				count_branch <= count_branch + 1;
+			if (cpu_state == cpu_state_shift)
+				count_shift <= count_shift + 1;
+			if (ENABLE_IRQ && !irq_active && |(irq_pending & ~irq_mask))
+				count_irq_wait <= count_irq_wait + 1;
+			if (!ENABLE_COUNTERS64) begin
+				count_fetch_wait[63:32] <= 0;
+				count_mem_wait[63:32] <= 0;
+				count_pcpi_wait[63:32] <= 0;
+				count_branch[63:32] <= 0;
+				count_shift[63:32] <= 0;
+				count_irq_wait[63:32] <= 0;
+			end
+		end else begin
+			count_fetch_wait <= 0;
+			count_mem_wait <= 0;
+			count_pcpi_wait <= 0;
+			count_branch <= 0;
+			count_shift <= 0;
+			count_irq_wait <= 0;
+		end
+	end
+
 	always @(posedge clk) begin
 		trap <= 0;
 		reg_sh <= 'bx;
@@ -1462,15 +1730,20 @@ module picorv32 #(
 			latched_store <= 0;
 			latched_stalu <= 0;
 			latched_branch <= 0;
+			latched_predict <= 0;
+			latched_mispredict <= 0;
 			latched_trace <= 0;
 			latched_is_lu <= 0;
 			latched_is_lh <= 0;
 			latched_is_lb <= 0;
 			pcpi_valid <= 0;
 			pcpi_timeout <= 0;
+			bht_valid <= 0;
 			irq_active <= 0;
 			irq_delay <= 0;
 			irq_mask <= ~0;
+			irq_vector <= 0;
+			irq_prio <= 0;
 			next_irq_pending = 0;
 			irq_state <= 0;
 			eoi <= 0;
@@ -1504,13 +1777,22 @@ module picorv32 #(
 						`debug($display("ST_RD:  %2d 0x%08x", latched_rd, latched_stalu ? alu_out_q : reg_out);)
 					end
 					ENABLE_IRQ && irq_state[0]: begin
-						current_pc = PROGADDR_IRQ;
+						current_pc = irq_vectored ? {irq_vector[31:7], irq_vector_num, 2'b00} : PROGADDR_IRQ;
 						irq_active <= 1;
 						mem_do_rinst <= 1;
+						if (ENABLE_TRACE && ENABLE_IRQ_VECTOR) begin
+							trace_valid <= 1;
+							trace_data <= TRACE_IRQ | TRACE_BRANCH | TRACE_ADDR | current_pc;
+						end
 					end
 					ENABLE_IRQ && irq_state[1]: begin
-						eoi <= irq_pending & ~irq_mask;
-						next_irq_pending = next_irq_pending & irq_mask;
+						if (irq_vectored) begin
+							eoi <= irq_vector_bit;
+							next_irq_pending = next_irq_pending & ~irq_vector_bit;
+						end else begin
+							eoi <= irq_pending & ~irq_mask;
+							next_irq_pending = next_irq_pending & irq_mask;
+						end
 					end
 				endcase
 
@@ -1518,9 +1800,9 @@ module picorv32 #(
 					latched_trace <= 0;
 					trace_valid <= 1;
 					if (latched_branch)
-						trace_data <= (irq_active ? TRACE_IRQ : 0) | TRACE_BRANCH | (current_pc & 32'hfffffffe);
+						trace_data <= (irq_active ? TRACE_IRQ : 0) | (latched_mispredict ? TRACE_MISPREDICT : 0) | TRACE_BRANCH | (current_pc & 32'hfffffffe);
 					else
-						trace_data <= (irq_active ? TRACE_IRQ : 0) | (latched_stalu ? alu_out_q : reg_out);
+						trace_data <= (irq_active ? TRACE_IRQ : 0) | (latched_mispredict ? TRACE_MISPREDICT : 0) | (latched_stalu ? alu_out_q : reg_out);
 				end
 
 				reg_pc <= current_pc;
@@ -1529,6 +1811,8 @@ module picorv32 #(
 				latched_store <= 0;
 				latched_stalu <= 0;
 				latched_branch <= 0;
+				latched_predict <= 0;
+				latched_mispredict <= 0;
 				latched_is_lu <= 0;
 				latched_is_lh <= 0;
 				latched_is_lb <= 0;
@@ -1539,6 +1823,8 @@ module picorv32 #(
 					irq_state <=
 						irq_state == 2'b00 ? 2'b01 :
 						irq_state == 2'b01 ? 2'b10 : 2'b00;
+					if (ENABLE_IRQ_VECTOR && !irq_state)
+						irq_vector_num <= irq_vector_next;
 					latched_compr <= latched_compr;
 					if (ENABLE_IRQ_QREGS)
 						latched_rd <= irqregs_offset | irq_state[0];
@@ -1558,6 +1844,10 @@ module picorv32 #(
 					`debug($display("-- %-0t", $time);)
 					irq_delay <= irq_active;
 					reg_next_pc <= current_pc + (compressed_instr ? 2 : 4);
+					if (BRANCH_PREDICT && is_beq_bne_blt_bge_bltu_bgeu && predict_taken) begin
+						latched_predict <= 1;
+						reg_next_pc <= predict_pc;
+					end
 					if (ENABLE_TRACE)
 						latched_trace <= 1;
 					if (ENABLE_COUNTERS) begin
@@ -1568,6 +1858,44 @@ module picorv32 #(
 						mem_do_rinst <= 1;
 						reg_next_pc <= current_pc + decoded_imm_j;
 						latched_branch <= 1;
+					end else
+					if (ENABLE_PIPELINE && |{pipe_lui_auipc, pipe_alu_imm, pipe_alu_reg, pipe_shift_imm, pipe_shift_reg, pipe_branch, pipe_store, pipe_load, pipe_jalr}) begin
+						`debug($display("LD_RS1: %2d 0x%08x", decoded_rs1, pipe_rs1);)
+						reg_op1 <= pipe_lui_auipc ? (instr_lui ? 0 : current_pc) : pipe_load ? pipe_rs1 + pipe_imm : pipe_rs1;
+						reg_op2 <= pipe_read_rs2 ? pipe_rs2 : pipe_shift_imm ? decoded_rs2 : pipe_imm;
+						reg_sh <= pipe_shift_reg ? pipe_rs2 : decoded_rs2;
+						if (!pipe_lui_auipc) begin
+							dbg_rs1val <= pipe_rs1;
+							dbg_rs1val_valid <= 1;
+						end
+						if (pipe_read_rs2) begin
+							`debug($display("LD_RS2: %2d 0x%08x", decoded_rs2, pipe_rs2);)
+							dbg_rs2val <= pipe_rs2;
+							dbg_rs2val_valid <= 1;
+						end
+						mem_do_prefetch <= !pipe_jalr;
+						(* parallel_case *)
+						case (1'b1)
+							pipe_store: begin
+								mem_do_rinst <= 1;
+								cpu_state <= cpu_state_stmem;
+							end
+							pipe_load: begin
+								mem_do_rinst <= 1;
+								cpu_state <= cpu_state_ldmem;
+							end
+							(pipe_shift_imm || pipe_shift_reg) && !BARREL_SHIFTER: begin
+								cpu_state <= cpu_state_shift;
+							end
+							default: begin
+								if (TWO_CYCLE_ALU || (TWO_CYCLE_COMPARE && pipe_branch)) begin
+									alu_wait_2 <= TWO_CYCLE_ALU && (TWO_CYCLE_COMPARE && pipe_branch);
+									alu_wait <= 1;
+								end else
+									mem_do_rinst <= !pipe_jalr;
+								cpu_state <= cpu_state_exec;
+							end
+						endcase
 					end else begin
 						mem_do_rinst <= 0;
 						mem_do_prefetch <= !instr_jalr && !instr_retirq;
@@ -1638,6 +1966,11 @@ module picorv32 #(
 						latched_store <= 1;
 						cpu_state <= cpu_state_fetch;
 					end
+					ENABLE_PERF_COUNTERS && (instr_rdhpm || instr_rdhpmh): begin
+						reg_out <= instr_rdhpmh ? count_perf[63:32] : count_perf[31:0];
+						latched_store <= 1;
+						cpu_state <= cpu_state_fetch;
+					end
 					is_lui_auipc_jal: begin
 						reg_op1 <= instr_lui ? 0 : reg_pc;
 						reg_op2 <= decoded_imm;
@@ -1693,9 +2026,27 @@ module picorv32 #(
 						dbg_rs1val_valid <= 1;
 						cpu_state <= cpu_state_fetch;
 					end
+					ENABLE_IRQ && ENABLE_IRQ_VECTOR && instr_irqvec: begin
+						latched_store <= 1;
+						reg_out <= irq_vector;
+						`debug($display("LD_RS1: %2d 0x%08x", decoded_rs1, cpuregs_rs1);)
+						irq_vector <= cpuregs_rs1;
+						dbg_rs1val <= cpuregs_rs1;
+						dbg_rs1val_valid <= 1;
+						cpu_state <= cpu_state_fetch;
+					end
+					ENABLE_IRQ && ENABLE_IRQ_VECTOR && instr_irqprio: begin
+						latched_store <= 1;
+						reg_out <= irq_prio;
+						`debug($display("LD_RS1: %2d 0x%08x", decoded_rs1, cpuregs_rs1);)
+						irq_prio <= cpuregs_rs1;
+						dbg_rs1val <= cpuregs_rs1;
+						dbg_rs1val_valid <= 1;
+						cpu_state <= cpu_state_fetch;
+					end
 					is_lb_lh_lw_lbu_lhu && !instr_trap: begin
 						`debug($display("LD_RS1: %2d 0x%08x", decoded_rs1, cpuregs_rs1);)
-						reg_op1 <= cpuregs_rs1;
+						reg_op1 <= ENABLE_EARLY_LOAD ? cpuregs_rs1 + decoded_imm : cpuregs_rs1;
 						dbg_rs1val <= cpuregs_rs1;
 						dbg_rs1val_valid <= 1;
 						cpu_state <= cpu_state_ldmem;
@@ -1814,9 +2165,21 @@ module picorv32 #(
 					latched_branch <= TWO_CYCLE_COMPARE ? alu_out_0_q : alu_out_0;
 					if (mem_done)
 						cpu_state <= cpu_state_fetch;
-					if (TWO_CYCLE_COMPARE ? alu_out_0_q : alu_out_0) begin
+					if ((TWO_CYCLE_COMPARE ? alu_out_0_q : alu_out_0) != latched_predict) begin
 						decoder_trigger <= 0;
 						set_mem_do_rinst = 1;
+						latched_mispredict <= BRANCH_PREDICT != 0;
+						if (latched_predict)
+							reg_next_pc <= reg_pc + (latched_compr ? 2 : 4);
+					end
+					if (BRANCH_PREDICT == 2 && mem_done) begin
+						bht_valid[resolve_index] <= 1;
+						if (!bht_valid[resolve_index])
+							bht_count[resolve_index] <= (TWO_CYCLE_COMPARE ? alu_out_0_q : alu_out_0) ? 2'b10 : 2'b01;
+						else if (TWO_CYCLE_COMPARE ? alu_out_0_q : alu_out_0)
+							bht_count[resolve_index] <= bht_count[resolve_index] + (bht_count[resolve_index] != 2'b11);
+						else
+							bht_count[resolve_index] <= bht_count[resolve_index] - (bht_count[resolve_index] != 2'b00);
 					end
 				end else begin
 					latched_branch <= instr_jalr;
@@ -1832,6 +2195,14 @@ module picorv32 #(
 					reg_out <= reg_op1;
 					mem_do_rinst <= mem_do_prefetch;
 					cpu_state <= cpu_state_fetch;
+				end else if (LOG_SHIFTER) begin
+					reg_op1 <= log_shift_out;
+					reg_sh <= reg_sh - log_shift_amount;
+					if (reg_sh == log_shift_amount) begin
+						reg_out <= log_shift_out;
+						mem_do_rinst <= mem_do_prefetch;
+						cpu_state <= cpu_state_fetch;
+					end
 				end else if (TWO_STAGE_SHIFT && reg_sh >= 4) begin
 					(* parallel_case, full_case *)
 					case (1'b1)
@@ -1887,14 +2258,15 @@ module picorv32 #(
 							instr_lh || instr_lhu: mem_wordsize <= 1;
 							instr_lw: mem_wordsize <= 0;
 						endcase
-						latched_is_lu <= is_lbu_lhu_lw;
+						latched_is_lu <= |{instr_lbu, instr_lhu, instr_lw};
 						latched_is_lh <= instr_lh;
 						latched_is_lb <= instr_lb;
 						if (ENABLE_TRACE) begin
 							trace_valid <= 1;
-							trace_data <= (irq_active ? TRACE_IRQ : 0) | TRACE_ADDR | ((reg_op1 + decoded_imm) & 32'hffffffff);
+							trace_data <= (irq_active ? TRACE_IRQ : 0) | TRACE_ADDR | ((ENABLE_EARLY_LOAD ? reg_op1 : reg_op1 + decoded_imm) & 32'hffffffff);
 						end
-						reg_op1 <= reg_op1 + decoded_imm;
+						if (!ENABLE_EARLY_LOAD)
+							reg_op1 <= reg_op1 + decoded_imm;
 						set_mem_do_rdata = 1;
 					end
 					if (!mem_do_prefetch && mem_done) begin
@@ -2196,7 +2568,8 @@ endmodule
 
 module picorv32_pcpi_mul #(
 	parameter STEPS_AT_ONCE = 1,
-	parameter CARRY_CHAIN = 4
+	parameter CARRY_CHAIN = 4,
+	parameter EARLY_OUT = 0
 ) (
 	input clk, resetn,
 
@@ -2245,6 +2618,14 @@ module picorv32_pcpi_mul #(
 	reg mul_finish;
 	integer i, j;
 
+	// With EARLY_OUT the operand with fewer significant bits is used as the multiplier
+	// (when both have the same signedness) and the multiply finishes as soon as the
+	// remaining multiplier bits are zero. The pending carries are added at the end.
+	wire mul_swap = EARLY_OUT && instr_rs1_signed == instr_rs2_signed && pcpi_rs2 < pcpi_rs1;
+	wire [31:0] mul_op1 = mul_swap ? pcpi_rs2 : pcpi_rs1;
+	wire [31:0] mul_op2 = mul_swap ? pcpi_rs1 : pcpi_rs2;
+	wire [63:0] mul_result = EARLY_OUT ? rd + rdx : rd;
+
 	// carry save accumulator
 	always @* begin
 		next_rd = rd;
@@ -2277,14 +2658,14 @@ module picorv32_pcpi_mul #(
 		end else
 		if (mul_waiting) begin
 			if (instr_rs1_signed)
-				rs1 <= $signed(pcpi_rs1);
+				rs1 <= $signed(mul_op1);
 			else
-				rs1 <= $unsigned(pcpi_rs1);
+				rs1 <= $unsigned(mul_op1);
 
 			if (instr_rs2_signed)
-				rs2 <= $signed(pcpi_rs2);
+				rs2 <= $signed(mul_op2);
 			else
-				rs2 <= $unsigned(pcpi_rs2);
+				rs2 <= $unsigned(mul_op2);
 
 			rd <= 0;
 			rdx <= 0;
@@ -2297,7 +2678,7 @@ module picorv32_pcpi_mul #(
 			rs2 <= next_rs2;
 
 			mul_counter <= mul_counter - STEPS_AT_ONCE;
-			if (mul_counter[6]) begin
+			if (mul_counter[6] || (EARLY_OUT && !next_rs1)) begin
 				mul_finish <= 1;
 				mul_waiting <= 1;
 			end
@@ -2310,7 +2691,7 @@ module picorv32_pcpi_mul #(
 		if (mul_finish && resetn) begin
 			pcpi_wr <= 1;
 			pcpi_ready <= 1;
-			pcpi_rd <= instr_any_mulh ? rd >> 32 : rd;
+			pcpi_rd <= instr_any_mulh ? mul_result >> 32 : mul_result;
 		end
 	end
 endmodule
@@ -2318,7 +2699,8 @@ endmodule
 module picorv32_pcpi_fast_mul #(
 	parameter EXTRA_MUL_FFS = 0,
 	parameter EXTRA_INSN_FFS = 0,
-	parameter MUL_CLKGATE = 0
+	parameter MUL_CLKGATE = 0,
+	parameter FUSE_MULH = 0
 ) (
 	input clk, resetn,
 
@@ -2345,6 +2727,13 @@ module picorv32_pcpi_fast_mul #(
 	wire pcpi_insn_valid = pcpi_valid && pcpi_insn[6:0] == 7'b0110011 && pcpi_insn[31:25] == 7'b0000001;
 	reg pcpi_insn_valid_q;
 
+	// With FUSE_MULH, a multiply with the same operands as the previous one (e.g. the
+	// MULH[[S]U]+MUL idiom) is answered from the cached product. MUL only needs the low
+	// halves to match, MULH[[S]U] must match the sign-extended operands as well.
+	reg rd_valid, fuse_ready;
+	wire fuse_hit = FUSE_MULH && rd_valid && (instr_mul ? rs1[31:0] == pcpi_rs1 && rs2[31:0] == pcpi_rs2 :
+			rs1 == {instr_rs1_signed && pcpi_rs1[31], pcpi_rs1} && rs2 == {instr_rs2_signed && pcpi_rs2[31], pcpi_rs2});
+
 	always @* begin
 		instr_mul = 0;
 		instr_mulh = 0;
@@ -2376,7 +2765,7 @@ module picorv32_pcpi_fast_mul #(
 	end
 
 	always @(posedge clk) begin
-		if (instr_any_mul && !(EXTRA_MUL_FFS ? active[3:0] : active[1:0])) begin
+		if (instr_any_mul && !fuse_hit && !(EXTRA_MUL_FFS ? active[3:0] : active[1:0])) begin
 			if (instr_rs1_signed)
 				rs1 <= $signed(pcpi_rs1);
 			else
@@ -2387,20 +2776,28 @@ module picorv32_pcpi_fast_mul #(
 			else
 				rs2 <= $unsigned(pcpi_rs2);
 			active[0] <= 1;
+			rd_valid <= 0;
 		end else begin
 			active[0] <= 0;
 		end
 
+		if (active[EXTRA_MUL_FFS ? 3 : 1])
+			rd_valid <= 1;
+
 		active[3:1] <= active;
 		shift_out <= instr_any_mulh;
+		fuse_ready <= pcpi_valid && instr_any_mul && fuse_hit && !fuse_ready;
 
-		if (!resetn)
+		if (!resetn) begin
 			active <= 0;
+			rd_valid <= 0;
+			fuse_ready <= 0;
+		end
 	end
 
-	assign pcpi_wr = active[EXTRA_MUL_FFS ? 3 : 1];
+	assign pcpi_wr = active[EXTRA_MUL_FFS ? 3 : 1] || fuse_ready;
 	assign pcpi_wait = 0;
-	assign pcpi_ready = active[EXTRA_MUL_FFS ? 3 : 1];
+	assign pcpi_ready = active[EXTRA_MUL_FFS ? 3 : 1] || fuse_ready;
 `ifdef RISCV_FORMAL_ALTOPS
 	assign pcpi_rd =
 			instr_mul    ? (pcpi_rs1 + pcpi_rs2) ^ 32'h5876063e :
@@ -2417,7 +2814,10 @@ endmodule
  * picorv32_pcpi_div
  ***************************************************************/
 
-module picorv32_pcpi_div (
+module picorv32_pcpi_div #(
+	parameter integer STEPS_AT_ONCE = 1,
+	parameter [0:0] EARLY_OUT = 0
+) (
 	input clk, resetn,
 
 	input             pcpi_valid,
@@ -2461,6 +2861,41 @@ module picorv32_pcpi_div (
 	reg running;
 	reg outsign;
 
+	reg [31:0] next_dividend;
+	reg [62:0] next_divisor;
+	reg [31:0] next_quotient;
+	reg [31:0] next_quotient_msk;
+	integer i;
+
+	// STEPS_AT_ONCE restoring steps per cycle. With EARLY_OUT, 8 steps that would all
+	// produce a zero quotient bit (divisor >> 7 > dividend) are skipped in one cycle.
+	// Steps after the last quotient bit (STEPS_AT_ONCE not dividing the remaining
+	// bits) must not touch the dividend, it holds the remainder.
+	always @* begin
+		next_dividend = dividend;
+		next_divisor = divisor;
+		next_quotient = quotient;
+		next_quotient_msk = quotient_msk;
+
+		if (EARLY_OUT && divisor >> 7 > dividend) begin
+			next_divisor = divisor >> 8;
+			next_quotient_msk = quotient_msk >> 8;
+		end else begin
+			for (i = 0; i < STEPS_AT_ONCE; i = i+1) begin
+				if (next_quotient_msk && next_divisor <= next_dividend) begin
+					next_dividend = next_dividend - next_divisor;
+					next_quotient = next_quotient | next_quotient_msk;
+				end
+				next_divisor = next_divisor >> 1;
+`ifdef RISCV_FORMAL_ALTOPS
+				next_quotient_msk = next_quotient_msk >> 5;
+`else
+				next_quotient_msk = next_quotient_msk >> 1;
+`endif
+			end
+		end
+	end
+
 	always @(posedge clk) begin
 		pcpi_ready <= 0;
 		pcpi_wr <= 0;
@@ -2495,16 +2930,284 @@ module picorv32_pcpi_div (
 				pcpi_rd <= outsign ? -dividend : dividend;
 `endif
 		end else begin
-			if (divisor <= dividend) begin
-				dividend <= dividend - divisor;
-				quotient <= quotient | quotient_msk;
+			dividend <= next_dividend;
+			divisor <= next_divisor;
+			quotient <= next_quotient;
+			quotient_msk <= next_quotient_msk;
+		end
+	end
+endmodule
+
+
+/***************************************************************
+ * picorv32_icache
+ ***************************************************************/
+
+// Instruction cache for the native memory interface, to be placed between the
+// core and the memory (picorv32_axi_adapter, the Wishbone bridge, spimemio).
+// Instruction fetches (mem_instr) are served from a direct-mapped (WAYS = 1) or
+// 2-way set-associative (WAYS = 2, LRU replacement) cache of SETS lines with
+// LINE_WORDS words each. A miss refills the whole line starting with the
+// requested word, which is passed on to the core as soon as it arrives. Data
+// accesses go straight through to the memory side.
+//
+// Stores are not snooped. After writing code to memory, run the icflush
+// instruction (custom-0 with funct7 = 0000110), which is executed by this
+// module via PCPI, to invalidate the whole cache.
+
+module picorv32_icache #(
+	parameter integer SETS = 64,
+	parameter integer WAYS = 1,
+	parameter integer LINE_WORDS = 4
+) (
+	input clk, resetn,
+
+	// Core side
+	input             mem_valid,
+	input             mem_instr,
+	output            mem_ready,
+	input      [31:0] mem_addr,
+	input      [31:0] mem_wdata,
+	input      [ 3:0] mem_wstrb,
+	output     [31:0] mem_rdata,
+
+	// Memory side
+	output            ext_mem_valid,
+	output            ext_mem_instr,
+	input             ext_mem_ready,
+	output     [31:0] ext_mem_addr,
+	output     [31:0] ext_mem_wdata,
+	output     [ 3:0] ext_mem_wstrb,
+	input      [31:0] ext_mem_rdata,
+
+	// PCPI (icflush instruction)
+	input             pcpi_valid,
+	input      [31:0] pcpi_insn,
+	output            pcpi_wr,
+	output     [31:0] pcpi_rd,
+	output            pcpi_wait,
+	output reg        pcpi_ready
+);
+	localparam integer WORD_BITS = $clog2(LINE_WORDS);
+	localparam integer INDEX_BITS = $clog2(SETS);
+	localparam integer TAG_BITS = 30 - WORD_BITS - INDEX_BITS;
+
+	localparam IDLE   = 2'b00;
+	localparam LOOKUP = 2'b01;
+	localparam REFILL = 2'b10;
+
+	reg [1:0] state;
+
+	wire [WORD_BITS-1:0] addr_word = mem_addr[2 +: WORD_BITS];
+	wire [INDEX_BITS-1:0] addr_index = mem_addr[2+WORD_BITS +: INDEX_BITS];
+	wire [TAG_BITS-1:0] addr_tag = mem_addr[31 -: TAG_BITS];
+
+	// refill_done delays a data access after a refill by one cycle, so that ext_mem_valid
+	// goes low between the two transactions (picorv32_axi_adapter relies on that)
+	reg refill_done;
+
+	wire fetch = mem_valid && mem_instr && !mem_wstrb;
+	wire bypass = state == IDLE && mem_valid && !fetch && !refill_done;
+
+	reg [WAYS*SETS-1:0] valid;
+	reg [SETS-1:0] lru;
+
+	reg refill_valid;
+	reg refill_ready;
+	reg refill_flushed;
+	reg refill_way;
+	reg [31:2+WORD_BITS] refill_line;
+	reg [WORD_BITS-1:0] refill_word;
+	reg [WORD_BITS-1:0] refill_count;
+	reg [31:0] refill_rdata;
+
+	wire [INDEX_BITS-1:0] refill_index = refill_line[2+WORD_BITS +: INDEX_BITS];
+	wire [TAG_BITS-1:0] refill_tag = refill_line[31 -: TAG_BITS];
+	wire refill_xfer = refill_valid && ext_mem_ready;
+
+	wire [WAYS-1:0] way_hit;
+	wire [32*WAYS-1:0] way_rdata;
+	wire hit = state == LOOKUP && |way_hit;
+	wire [31:0] hit_rdata = way_hit[WAYS-1] ? way_rdata[32*(WAYS-1) +: 32] : way_rdata[31:0];
+
+	genvar w;
+	generate for (w = 0; w < WAYS; w = w+1) begin:ways
+		reg [31:0] data [0:SETS*LINE_WORDS-1];
+		reg [TAG_BITS-1:0] tags [0:SETS-1];
+		reg [31:0] data_q;
+		reg [TAG_BITS-1:0] tag_q;
+
+		always @(posedge clk) begin
+			if (refill_xfer && refill_way == w) begin
+				data[{refill_index, refill_word}] <= ext_mem_rdata;
+				tags[refill_index] <= refill_tag;
+			end
+			data_q <= data[{addr_index, addr_word}];
+			tag_q <= tags[addr_index];
+		end
+
+		assign way_hit[w] = valid[w*SETS + addr_index] && tag_q == addr_tag;
+		assign way_rdata[32*w +: 32] = data_q;
+	end endgenerate
+
+	assign ext_mem_valid = bypass || refill_valid;
+	assign ext_mem_instr = bypass ? mem_instr : 1'b1;
+	assign ext_mem_addr = bypass ? mem_addr : {refill_line, refill_word, 2'b00};
+	assign ext_mem_wdata = mem_wdata;
+	assign ext_mem_wstrb = bypass ? mem_wstrb : 4'b0;
+
+	assign mem_ready = bypass ? ext_mem_ready : hit || refill_ready;
+	assign mem_rdata = bypass ? ext_mem_rdata : hit ? hit_rdata : refill_rdata;
+
+	assign pcpi_wr = 0;
+	assign pcpi_rd = 0;
+	assign pcpi_wait = 0;
+
+	always @(posedge clk) begin
+		refill_ready <= 0;
+		refill_done <= 0;
+		pcpi_ready <= 0;
+
+		if (!resetn) begin
+			state <= IDLE;
+			valid <= 0;
+			lru <= 0;
+			refill_valid <= 0;
+		end else begin
+			case (state)
+				IDLE: begin
+					if (fetch)
+						state <= LOOKUP;
+				end
+				LOOKUP: begin
+					if (hit) begin
+						state <= IDLE;
+						if (WAYS == 2)
+							lru[addr_index] <= !way_hit[WAYS-1];
+					end else begin
+						state <= REFILL;
+						refill_valid <= 1;
+						refill_flushed <= 0;
+						refill_way <= WAYS == 2 && lru[addr_index];
+						refill_line <= mem_addr[31:2+WORD_BITS];
+						refill_word <= addr_word;
+						refill_count <= 0;
+						valid[(WAYS == 2 && lru[addr_index])*SETS + addr_index] <= 0;
+					end
+				end
+				REFILL: begin
+					if (refill_xfer) begin
+						refill_word <= refill_word + 1;
+						refill_count <= refill_count + 1;
+						if (refill_count == 0) begin
+							refill_ready <= 1;
+							refill_rdata <= ext_mem_rdata;
+						end
+						if (refill_count == LINE_WORDS-1) begin
+							state <= IDLE;
+							refill_valid <= 0;
+							refill_done <= 1;
+							valid[refill_way*SETS + refill_index] <= !refill_flushed;
+							if (WAYS == 2)
+								lru[refill_index] <= !refill_way;
+						end
+					end
+				end
+			endcase
+
+			if (pcpi_valid && !pcpi_ready && pcpi_insn[6:0] == 7'b0001011 && pcpi_insn[31:25] == 7'b0000110) begin
+				valid <= 0;
+				refill_flushed <= 1;
+				pcpi_ready <= 1;
+			end
+		end
+	end
+endmodule
+
+
+/***************************************************************
+ * picorv32_store_buffer
+ ***************************************************************/
+
+// Posted-write buffer used by picorv32_axi_adapter and the Wishbone bridge in
+// picorv32_wb. Stores are accepted into a FIFO of ENTRIES entries and
+// acknowledged to the core right away; the bus side writes them out in order.
+// A read whose word address matches a buffered store must wait (rd_hazard) until
+// that store has been written, reads from other RAM addresses may pass buffered
+// stores. Reads at or above IO_ADDR are I/O and wait until the buffer is empty,
+// so that they are not reordered with earlier (I/O) stores. IO_ADDR defaults to
+// 0, i.e. every read waits; set it to the start of the I/O region (above all RAM).
+//
+// FENCE waits for the buffer to drain: the wrappers set PCPI_FENCE on the core
+// and hold pcpi_wait until empty is set.
+
+module picorv32_store_buffer #(
+	parameter integer ENTRIES = 2,
+	parameter [31:0] IO_ADDR = 0
+) (
+	input clk, resetn,
+
+	// Stores from the core
+	input             st_valid,
+	output            st_ready,
+	input      [31:0] st_addr,
+	input      [31:0] st_wdata,
+	input      [ 3:0] st_wstrb,
+
+	// Oldest buffered store
+	output            wr_valid,
+	input             wr_ready,
+	output     [31:0] wr_addr,
+	output     [31:0] wr_wdata,
+	output     [ 3:0] wr_wstrb,
+
+	// Read hazard check
+	input      [31:0] rd_addr,
+	output reg        rd_hazard,
+
+	output            empty
+);
+	reg [31:0] buf_addr [0:ENTRIES-1];
+	reg [31:0] buf_wdata [0:ENTRIES-1];
+	reg [ 3:0] buf_wstrb [0:ENTRIES-1];
+	localparam integer PTR_BITS = ENTRIES > 1 ? $clog2(ENTRIES) : 1;
+
+	reg [ENTRIES-1:0] buf_valid;
+	reg [PTR_BITS-1:0] head, tail;
+
+	assign st_ready = !buf_valid[tail];
+	assign wr_valid = buf_valid[head];
+	assign wr_addr = buf_addr[head];
+	assign wr_wdata = buf_wdata[head];
+	assign wr_wstrb = buf_wstrb[head];
+	assign empty = !buf_valid;
+
+	integer i;
+
+	always @* begin
+		rd_hazard = rd_addr >= IO_ADDR && buf_valid;
+		for (i = 0; i < ENTRIES; i = i+1)
+			if (buf_valid[i] && buf_addr[i][31:2] == rd_addr[31:2])
+				rd_hazard = 1;
+	end
+
+	always @(posedge clk) begin
+		if (!resetn) begin
+			buf_valid <= 0;
+			head <= 0;
+			tail <= 0;
+		end else begin
+			if (st_valid && st_ready) begin
+				buf_addr[tail] <= st_addr;
+				buf_wdata[tail] <= st_wdata;
+				buf_wstrb[tail] <= st_wstrb;
+				buf_valid[tail] <= 1;
+				tail <= tail == ENTRIES-1 ? 0 : tail + 1;
+			end
+			if (wr_valid && wr_ready) begin
+				buf_valid[head] <= 0;
+				head <= head == ENTRIES-1 ? 0 : head + 1;
 			end
-			divisor <= divisor >> 1;
-`ifdef RISCV_FORMAL_ALTOPS
-			quotient_msk <= quotient_msk >> 5;
-`else
-			quotient_msk <= quotient_msk >> 1;
-`endif
 		end
 	end
 endmodule
@@ -2517,29 +3220,46 @@ endmodule
 module picorv32_axi #(
 	parameter [ 0:0] ENABLE_COUNTERS = 1,
 	parameter [ 0:0] ENABLE_COUNTERS64 = 1,
+	parameter [ 0:0] ENABLE_PERF_COUNTERS = 0,
 	parameter [ 0:0] ENABLE_REGS_16_31 = 1,
 	parameter [ 0:0] ENABLE_REGS_DUALPORT = 1,
 	parameter [ 0:0] TWO_STAGE_SHIFT = 1,
 	parameter [ 0:0] BARREL_SHIFTER = 0,
+	parameter [ 0:0] LOG_SHIFTER = 0,
 	parameter [ 0:0] TWO_CYCLE_COMPARE = 0,
 	parameter [ 0:0] TWO_CYCLE_ALU = 0,
+	parameter [ 0:0] ENABLE_PIPELINE = 0,
+	parameter integer BRANCH_PREDICT = 0,
+	parameter integer BRANCH_PREDICT_ENTRIES = 16,
+	parameter [ 0:0] ENABLE_EARLY_LOAD = 0,
 	parameter [ 0:0] COMPRESSED_ISA = 0,
 	parameter [ 0:0] CATCH_MISALIGN = 1,
 	parameter [ 0:0] CATCH_ILLINSN = 1,
 	parameter [ 0:0] ENABLE_PCPI = 0,
 	parameter [ 0:0] ENABLE_MUL = 0,
+	parameter [ 0:0] MUL_EARLY_OUT = 0,
 	parameter [ 0:0] ENABLE_FAST_MUL = 0,
+	parameter [ 0:0] FAST_MUL_FUSE = 0,
 	parameter [ 0:0] ENABLE_DIV = 0,
+	parameter integer DIV_BITS_PER_CYCLE = 1,
+	parameter [ 0:0] DIV_EARLY_OUT = 0,
 	parameter [ 0:0] ENABLE_IRQ = 0,
 	parameter [ 0:0] ENABLE_IRQ_QREGS = 1,
+	parameter [ 0:0] ENABLE_IRQ_BANK = 0,
 	parameter [ 0:0] ENABLE_IRQ_TIMER = 1,
+	parameter [ 0:0] ENABLE_IRQ_VECTOR = 0,
 	parameter [ 0:0] ENABLE_TRACE = 0,
 	parameter [ 0:0] REGS_INIT_ZERO = 0,
 	parameter [31:0] MASKED_IRQ = 32'h 0000_0000,
 	parameter [31:0] LATCHED_IRQ = 32'h ffff_ffff,
 	parameter [31:0] PROGADDR_RESET = 32'h 0000_0000,
 	parameter [31:0] PROGADDR_IRQ = 32'h 0000_0010,
-	parameter [31:0] STACKADDR = 32'h ffff_ffff
+	parameter [31:0] STACKADDR = 32'h ffff_ffff,
+	parameter integer ICACHE_SETS = 0,
+	parameter integer ICACHE_WAYS = 1,
+	parameter integer ICACHE_LINE_WORDS = 4,
+	parameter integer STORE_BUFFER_ENTRIES = 0,
+	parameter [31:0] STORE_BUFFER_IO_ADDR = 0
 ) (
 	input clk, resetn,
 	output trap,
@@ -2616,7 +3336,66 @@ module picorv32_axi #(
 	wire        mem_ready;
 	wire [31:0] mem_rdata;
 
-	picorv32_axi_adapter axi_adapter (
+	wire        icache_mem_valid;
+	wire [31:0] icache_mem_addr;
+	wire [31:0] icache_mem_wdata;
+	wire [ 3:0] icache_mem_wstrb;
+	wire        icache_mem_instr;
+	wire        icache_mem_ready;
+	wire [31:0] icache_mem_rdata;
+	wire        icache_pcpi_ready;
+
+	generate if (ICACHE_SETS) begin:icache
+		picorv32_icache #(
+			.SETS      (ICACHE_SETS      ),
+			.WAYS      (ICACHE_WAYS      ),
+			.LINE_WORDS(ICACHE_LINE_WORDS)
+		) icache (
+			.clk          (clk              ),
+			.resetn       (resetn           ),
+			.mem_valid    (mem_valid        ),
+			.mem_instr    (mem_instr        ),
+			.mem_ready    (mem_ready        ),
+			.mem_addr     (mem_addr         ),
+			.mem_wdata    (mem_wdata        ),
+			.mem_wstrb    (mem_wstrb        ),
+			.mem_rdata    (mem_rdata        ),
+			.ext_mem_valid(icache_mem_valid ),
+			.ext_mem_instr(icache_mem_instr ),
+			.ext_mem_ready(icache_mem_ready ),
+			.ext_mem_addr (icache_mem_addr  ),
+			.ext_mem_wdata(icache_mem_wdata ),
+			.ext_mem_wstrb(icache_mem_wstrb ),
+			.ext_mem_rdata(icache_mem_rdata ),
+			.pcpi_valid   (pcpi_valid       ),
+			.pcpi_insn    (pcpi_insn        ),
+			.pcpi_wr      (                 ),
+			.pcpi_rd      (                 ),
+			.pcpi_wait    (                 ),
+			.pcpi_ready   (icache_pcpi_ready)
+		);
+	end else begin
+		assign icache_mem_valid = mem_valid;
+		assign icache_mem_instr = mem_instr;
+		assign icache_mem_addr = mem_addr;
+		assign icache_mem_wdata = mem_wdata;
+		assign icache_mem_wstrb = mem_wstrb;
+		assign mem_ready = icache_mem_ready;
+		assign mem_rdata = icache_mem_rdata;
+		assign icache_pcpi_ready = 0;
+	end endgenerate
+
+	wire        store_buffer_empty;
+
+	// FENCE is passed to PCPI and waits here until all buffered stores are written
+	wire        store_buffer_fence = STORE_BUFFER_ENTRIES && pcpi_valid && pcpi_insn[6:0] == 7'b0001111 && !pcpi_insn[14:12];
+	wire        store_buffer_pcpi_wait = store_buffer_fence && !store_buffer_empty;
+	wire        store_buffer_pcpi_ready = store_buffer_fence && store_buffer_empty;
+
+	picorv32_axi_adapter #(
+		.STORE_BUFFER_ENTRIES(STORE_BUFFER_ENTRIES),
+		.STORE_BUFFER_IO_ADDR(STORE_BUFFER_IO_ADDR)
+	) axi_adapter (
 		.clk            (clk            ),
 		.resetn         (resetn         ),
 		.mem_axi_awvalid(mem_axi_awvalid),
@@ -2636,34 +3415,48 @@ module picorv32_axi #(
 		.mem_axi_rvalid (mem_axi_rvalid ),
 		.mem_axi_rready (mem_axi_rready ),
 		.mem_axi_rdata  (mem_axi_rdata  ),
-		.mem_valid      (mem_valid      ),
-		.mem_instr      (mem_instr      ),
-		.mem_ready      (mem_ready      ),
-		.mem_addr       (mem_addr       ),
-		.mem_wdata      (mem_wdata      ),
-		.mem_wstrb      (mem_wstrb      ),
-		.mem_rdata      (mem_rdata      )
+		.mem_valid      (icache_mem_valid),
+		.mem_instr      (icache_mem_instr),
+		.mem_ready      (icache_mem_ready),
+		.mem_addr       (icache_mem_addr ),
+		.mem_wdata      (icache_mem_wdata),
+		.mem_wstrb      (icache_mem_wstrb),
+		.mem_rdata      (icache_mem_rdata),
+		.store_buffer_empty(store_buffer_empty)
 	);
 
 	picorv32 #(
 		.ENABLE_COUNTERS     (ENABLE_COUNTERS     ),
 		.ENABLE_COUNTERS64   (ENABLE_COUNTERS64   ),
+		.ENABLE_PERF_COUNTERS(ENABLE_PERF_COUNTERS),
 		.ENABLE_REGS_16_31   (ENABLE_REGS_16_31   ),
 		.ENABLE_REGS_DUALPORT(ENABLE_REGS_DUALPORT),
 		.TWO_STAGE_SHIFT     (TWO_STAGE_SHIFT     ),
 		.BARREL_SHIFTER      (BARREL_SHIFTER      ),
+		.LOG_SHIFTER         (LOG_SHIFTER         ),
 		.TWO_CYCLE_COMPARE   (TWO_CYCLE_COMPARE   ),
 		.TWO_CYCLE_ALU       (TWO_CYCLE_ALU       ),
+		.ENABLE_PIPELINE     (ENABLE_PIPELINE     ),
+		.BRANCH_PREDICT      (BRANCH_PREDICT      ),
+		.BRANCH_PREDICT_ENTRIES(BRANCH_PREDICT_ENTRIES),
+		.ENABLE_EARLY_LOAD   (ENABLE_EARLY_LOAD   ),
 		.COMPRESSED_ISA      (COMPRESSED_ISA      ),
 		.CATCH_MISALIGN      (CATCH_MISALIGN      ),
 		.CATCH_ILLINSN       (CATCH_ILLINSN       ),
-		.ENABLE_PCPI         (ENABLE_PCPI         ),
+		.ENABLE_PCPI         (ENABLE_PCPI || ICACHE_SETS != 0 || STORE_BUFFER_ENTRIES != 0),
+		.PCPI_FENCE          (STORE_BUFFER_ENTRIES != 0),
 		.ENABLE_MUL          (ENABLE_MUL          ),
+		.MUL_EARLY_OUT       (MUL_EARLY_OUT       ),
 		.ENABLE_FAST_MUL     (ENABLE_FAST_MUL     ),
+		.FAST_MUL_FUSE       (FAST_MUL_FUSE       ),
 		.ENABLE_DIV          (ENABLE_DIV          ),
+		.DIV_BITS_PER_CYCLE  (DIV_BITS_PER_CYCLE  ),
+		.DIV_EARLY_OUT       (DIV_EARLY_OUT       ),
 		.ENABLE_IRQ          (ENABLE_IRQ          ),
 		.ENABLE_IRQ_QREGS    (ENABLE_IRQ_QREGS    ),
+		.ENABLE_IRQ_BANK     (ENABLE_IRQ_BANK     ),
 		.ENABLE_IRQ_TIMER    (ENABLE_IRQ_TIMER    ),
+		.ENABLE_IRQ_VECTOR   (ENABLE_IRQ_VECTOR   ),
 		.ENABLE_TRACE        (ENABLE_TRACE        ),
 		.REGS_INIT_ZERO      (REGS_INIT_ZERO      ),
 		.MASKED_IRQ          (MASKED_IRQ          ),
@@ -2688,10 +3481,10 @@ module picorv32_axi #(
 		.pcpi_insn (pcpi_insn ),
 		.pcpi_rs1  (pcpi_rs1  ),
 		.pcpi_rs2  (pcpi_rs2  ),
-		.pcpi_wr   (pcpi_wr   ),
+		.pcpi_wr   (ENABLE_PCPI && pcpi_wr),
 		.pcpi_rd   (pcpi_rd   ),
-		.pcpi_wait (pcpi_wait ),
-		.pcpi_ready(pcpi_ready),
+		.pcpi_wait ((ENABLE_PCPI && pcpi_wait) || store_buffer_pcpi_wait),
+		.pcpi_ready((ENABLE_PCPI && pcpi_ready) || icache_pcpi_ready || store_buffer_pcpi_ready),
 
 		.irq(irq),
 		.eoi(eoi),
@@ -2728,7 +3521,10 @@ endmodule
  * picorv32_axi_adapter
  ***************************************************************/
 
-module picorv32_axi_adapter (
+module picorv32_axi_adapter #(
+	parameter integer STORE_BUFFER_ENTRIES = 0,
+	parameter [31:0] STORE_BUFFER_IO_ADDR = 0
+) (
 	input clk, resetn,
 
 	// AXI4-lite master memory interface
@@ -2763,33 +3559,79 @@ module picorv32_axi_adapter (
 	input  [31:0] mem_addr,
 	input  [31:0] mem_wdata,
 	input  [ 3:0] mem_wstrb,
-	output [31:0] mem_rdata
+	output [31:0] mem_rdata,
+
+	// Store buffer state (always set without STORE_BUFFER_ENTRIES)
+	output        store_buffer_empty
 );
 	reg ack_awvalid;
 	reg ack_arvalid;
 	reg ack_wvalid;
 	reg xfer_done;
 
-	assign mem_axi_awvalid = mem_valid && |mem_wstrb && !ack_awvalid;
-	assign mem_axi_awaddr = mem_addr;
+	// With STORE_BUFFER_ENTRIES the write channel is driven by the oldest buffered
+	// store and the core only waits for a free entry. Reads run on the read channel
+	// in parallel, unless they hit a buffered store.
+	wire        wr_valid;
+	wire [31:0] wr_addr;
+	wire [31:0] wr_wdata;
+	wire [ 3:0] wr_wstrb;
+	wire        st_ready;
+	wire        rd_hazard;
+
+	generate if (STORE_BUFFER_ENTRIES) begin:store_buffer
+		picorv32_store_buffer #(
+			.ENTRIES(STORE_BUFFER_ENTRIES),
+			.IO_ADDR(STORE_BUFFER_IO_ADDR)
+		) store_buffer (
+			.clk      (clk                    ),
+			.resetn   (resetn                 ),
+			.st_valid (mem_valid && |mem_wstrb),
+			.st_ready (st_ready               ),
+			.st_addr  (mem_addr               ),
+			.st_wdata (mem_wdata              ),
+			.st_wstrb (mem_wstrb              ),
+			.wr_valid (wr_valid               ),
+			.wr_ready (mem_axi_bvalid         ),
+			.wr_addr  (wr_addr                ),
+			.wr_wdata (wr_wdata               ),
+			.wr_wstrb (wr_wstrb               ),
+			.rd_addr  (mem_addr               ),
+			.rd_hazard(rd_hazard              ),
+			.empty    (store_buffer_empty     )
+		);
+	end else begin
+		assign wr_valid = mem_valid && |mem_wstrb;
+		assign wr_addr = mem_addr;
+		assign wr_wdata = mem_wdata;
+		assign wr_wstrb = mem_wstrb;
+		assign st_ready = mem_axi_bvalid;
+		assign rd_hazard = 0;
+		assign store_buffer_empty = 1;
+	end endgenerate
+
+	assign mem_axi_awvalid = wr_valid && !ack_awvalid;
+	assign mem_axi_awaddr = wr_addr;
 	assign mem_axi_awprot = 0;
 
-	assign mem_axi_arvalid = mem_valid && !mem_wstrb && !ack_arvalid;
+	assign mem_axi_arvalid = mem_valid && !mem_wstrb && !ack_arvalid && !rd_hazard;
 	assign mem_axi_araddr = mem_addr;
 	assign mem_axi_arprot = mem_instr ? 3'b100 : 3'b000;
 
-	assign mem_axi_wvalid = mem_valid && |mem_wstrb && !ack_wvalid;
-	assign mem_axi_wdata = mem_wdata;
-	assign mem_axi_wstrb = mem_wstrb;
+	assign mem_axi_wvalid = wr_valid && !ack_wvalid;
+	assign mem_axi_wdata = wr_wdata;
+	assign mem_axi_wstrb = wr_wstrb;
 
-	assign mem_ready = mem_axi_bvalid || mem_axi_rvalid;
-	assign mem_axi_bready = mem_valid && |mem_wstrb;
+	assign mem_ready = (STORE_BUFFER_ENTRIES ? mem_valid && |mem_wstrb && st_ready : st_ready) || mem_axi_rvalid;
+	assign mem_axi_bready = wr_valid;
 	assign mem_axi_rready = mem_valid && !mem_wstrb;
 	assign mem_rdata = mem_axi_rdata;
 
 	always @(posedge clk) begin
 		if (!resetn) begin
 			ack_awvalid <= 0;
+			ack_arvalid <= 0;
+			ack_wvalid <= 0;
 		end else begin
 			xfer_done <= mem_valid && mem_ready;
 			if (mem_axi_awready && mem_axi_awvalid)
@@ -2799,8 +3641,14 @@ module picorv32_axi_adapter (
 			if (mem_axi_wready && mem_axi_wvalid)
 				ack_wvalid <= 1;
 			if (xfer_done || !mem_valid) begin
-				ack_awvalid <= 0;
 				ack_arvalid <= 0;
+				if (!STORE_BUFFER_ENTRIES) begin
+					ack_awvalid <= 0;
+					ack_wvalid <= 0;
+				end
+			end
+			if (STORE_BUFFER_ENTRIES && mem_axi_bvalid) begin
+				ack_awvalid <= 0;
 				ack_wvalid <= 0;
 			end
 		end
@@ -2815,29 +3663,46 @@ endmodule
 module picorv32_wb #(
 	parameter [ 0:0] ENABLE_COUNTERS = 1,
 	parameter [ 0:0] ENABLE_COUNTERS64 = 1,
+	parameter [ 0:0] ENABLE_PERF_COUNTERS = 0,
 	parameter [ 0:0] ENABLE_REGS_16_31 = 1,
 	parameter [ 0:0] ENABLE_REGS_DUALPORT = 1,
 	parameter [ 0:0] TWO_STAGE_SHIFT = 1,
 	parameter [ 0:0] BARREL_SHIFTER = 0,
+	parameter [ 0:0] LOG_SHIFTER = 0,
 	parameter [ 0:0] TWO_CYCLE_COMPARE = 0,
 	parameter [ 0:0] TWO_CYCLE_ALU = 0,
+	parameter [ 0:0] ENABLE_PIPELINE = 0,
+	parameter integer BRANCH_PREDICT = 0,
+	parameter integer BRANCH_PREDICT_ENTRIES = 16,
+	parameter [ 0:0] ENABLE_EARLY_LOAD = 0,
 	parameter [ 0:0] COMPRESSED_ISA = 0,
 	parameter [ 0:0] CATCH_MISALIGN = 1,
 	parameter [ 0:0] CATCH_ILLINSN = 1,
 	parameter [ 0:0] ENABLE_PCPI = 0,
 	parameter [ 0:0] ENABLE_MUL = 0,
+	parameter [ 0:0] MUL_EARLY_OUT = 0,
 	parameter [ 0:0] ENABLE_FAST_MUL = 0,
+	parameter [ 0:0] FAST_MUL_FUSE = 0,
 	parameter [ 0:0] ENABLE_DIV = 0,
+	parameter integer DIV_BITS_PER_CYCLE = 1,
+	parameter [ 0:0] DIV_EARLY_OUT = 0,
 	parameter [ 0:0] ENABLE_IRQ = 0,
 	parameter [ 0:0] ENABLE_IRQ_QREGS = 1,
+	parameter [ 0:0] ENABLE_IRQ_BANK = 0,
 	parameter [ 0:0] ENABLE_IRQ_TIMER = 1,
+	parameter [ 0:0] ENABLE_IRQ_VECTOR = 0,
 	parameter [ 0:0] ENABLE_TRACE = 0,
 	parameter [ 0:0] REGS_INIT_ZERO = 0,
 	parameter [31:0] MASKED_IRQ = 32'h 0000_0000,
 	parameter [31:0] LATCHED_IRQ = 32'h ffff_ffff,
 	parameter [31:0] PROGADDR_RESET = 32'h 0000_0000,
 	parameter [31:0] PROGADDR_IRQ = 32'h 0000_0010,
-	parameter [31:0] STACKADDR = 32'h ffff_ffff
+	parameter [31:0] STACKADDR = 32'h ffff_ffff,
+	parameter integer ICACHE_SETS = 0,
+	parameter integer ICACHE_WAYS = 1,
+	parameter integer ICACHE_LINE_WORDS = 4,
+	parameter integer STORE_BUFFER_ENTRIES = 0,
+	parameter [31:0] STORE_BUFFER_IO_ADDR = 0
 ) (
 	output trap,
 
@@ -2900,34 +3765,103 @@ module picorv32_wb #(
 	wire [31:0] mem_addr;
 	wire [31:0] mem_wdata;
 	wire [ 3:0] mem_wstrb;
-	reg         mem_ready;
-	reg [31:0] mem_rdata;
+	wire        mem_ready;
+	wire [31:0] mem_rdata;
 
 	wire clk;
 	wire resetn;
 
+	wire        icache_mem_valid;
+	wire [31:0] icache_mem_addr;
+	wire [31:0] icache_mem_wdata;
+	wire [ 3:0] icache_mem_wstrb;
+	wire        icache_mem_instr;
+	reg         icache_mem_ready;
+	reg  [31:0] icache_mem_rdata;
+	wire        icache_pcpi_ready;
+
 	assign clk = wb_clk_i;
 	assign resetn = ~wb_rst_i;
 
+	generate if (ICACHE_SETS) begin:icache
+		picorv32_icache #(
+			.SETS      (ICACHE_SETS      ),
+			.WAYS      (ICACHE_WAYS      ),
+			.LINE_WORDS(ICACHE_LINE_WORDS)
+		) icache (
+			.clk          (clk              ),
+			.resetn       (resetn           ),
+			.mem_valid    (mem_valid        ),
+			.mem_instr    (mem_instr        ),
+			.mem_ready    (mem_ready        ),
+			.mem_addr     (mem_addr         ),
+			.mem_wdata    (mem_wdata        ),
+			.mem_wstrb    (mem_wstrb        ),
+			.mem_rdata    (mem_rdata        ),
+			.ext_mem_valid(icache_mem_valid ),
+			.ext_mem_instr(icache_mem_instr ),
+			.ext_mem_ready(icache_mem_ready ),
+			.ext_mem_addr (icache_mem_addr  ),
+			.ext_mem_wdata(icache_mem_wdata ),
+			.ext_mem_wstrb(icache_mem_wstrb ),
+			.ext_mem_rdata(icache_mem_rdata ),
+			.pcpi_valid   (pcpi_valid       ),
+			.pcpi_insn    (pcpi_insn        ),
+			.pcpi_wr      (                 ),
+			.pcpi_rd      (                 ),
+			.pcpi_wait    (                 ),
+			.pcpi_ready   (icache_pcpi_ready)
+		);
+	end else begin
+		assign icache_mem_valid = mem_valid;
+		assign icache_mem_instr = mem_instr;
+		assign icache_mem_addr = mem_addr;
+		assign icache_mem_wdata = mem_wdata;
+		assign icache_mem_wstrb = mem_wstrb;
+		assign mem_ready = icache_mem_ready;
+		assign mem_rdata = icache_mem_rdata;
+		assign icache_pcpi_ready = 0;
+	end endgenerate
+
+	wire        store_buffer_empty;
+
+	// FENCE is passed to PCPI and waits here until all buffered stores are written
+	wire        store_buffer_fence = STORE_BUFFER_ENTRIES && pcpi_valid && pcpi_insn[6:0] == 7'b0001111 && !pcpi_insn[14:12];
+	wire        store_buffer_pcpi_wait = store_buffer_fence && !store_buffer_empty;
+	wire        store_buffer_pcpi_ready = store_buffer_fence && store_buffer_empty;
+
 	picorv32 #(
 		.ENABLE_COUNTERS     (ENABLE_COUNTERS     ),
 		.ENABLE_COUNTERS64   (ENABLE_COUNTERS64   ),
+		.ENABLE_PERF_COUNTERS(ENABLE_PERF_COUNTERS),
 		.ENABLE_REGS_16_31   (ENABLE_REGS_16_31   ),
 		.ENABLE_REGS_DUALPORT(ENABLE_REGS_DUALPORT),
 		.TWO_STAGE_SHIFT     (TWO_STAGE_SHIFT     ),
 		.BARREL_SHIFTER      (BARREL_SHIFTER      ),
+		.LOG_SHIFTER         (LOG_SHIFTER         ),
 		.TWO_CYCLE_COMPARE   (TWO_CYCLE_COMPARE   ),
 		.TWO_CYCLE_ALU       (TWO_CYCLE_ALU       ),
+		.ENABLE_PIPELINE     (ENABLE_PIPELINE     ),
+		.BRANCH_PREDICT      (BRANCH_PREDICT      ),
+		.BRANCH_PREDICT_ENTRIES(BRANCH_PREDICT_ENTRIES),
+		.ENABLE_EARLY_LOAD   (ENABLE_EARLY_LOAD   ),
 		.COMPRESSED_ISA      (COMPRESSED_ISA      ),
 		.CATCH_MISALIGN      (CATCH_MISALIGN      ),
 		.CATCH_ILLINSN       (CATCH_ILLINSN       ),
-		.ENABLE_PCPI         (ENABLE_PCPI         ),
+		.ENABLE_PCPI         (ENABLE_PCPI || ICACHE_SETS != 0 || STORE_BUFFER_ENTRIES != 0),
+		.PCPI_FENCE          (STORE_BUFFER_ENTRIES != 0),
 		.ENABLE_MUL          (ENABLE_MUL          ),
+		.MUL_EARLY_OUT       (MUL_EARLY_OUT       ),
 		.ENABLE_FAST_MUL     (ENABLE_FAST_MUL     ),
+		.FAST_MUL_FUSE       (FAST_MUL_FUSE       ),
 		.ENABLE_DIV          (ENABLE_DIV          ),
+		.DIV_BITS_PER_CYCLE  (DIV_BITS_PER_CYCLE  ),
+		.DIV_EARLY_OUT       (DIV_EARLY_OUT       ),
 		.ENABLE_IRQ          (ENABLE_IRQ          ),
 		.ENABLE_IRQ_QREGS    (ENABLE_IRQ_QREGS    ),
+		.ENABLE_IRQ_BANK     (ENABLE_IRQ_BANK     ),
 		.ENABLE_IRQ_TIMER    (ENABLE_IRQ_TIMER    ),
+		.ENABLE_IRQ_VECTOR   (ENABLE_IRQ_VECTOR   ),
 		.ENABLE_TRACE        (ENABLE_TRACE        ),
 		.REGS_INIT_ZERO      (REGS_INIT_ZERO      ),
 		.MASKED_IRQ          (MASKED_IRQ          ),
@@ -2952,10 +3886,10 @@ module picorv32_wb #(
 		.pcpi_insn (pcpi_insn ),
 		.pcpi_rs1  (pcpi_rs1  ),
 		.pcpi_rs2  (pcpi_rs2  ),
-		.pcpi_wr   (pcpi_wr   ),
+		.pcpi_wr   (ENABLE_PCPI && pcpi_wr),
 		.pcpi_rd   (pcpi_rd   ),
-		.pcpi_wait (pcpi_wait ),
-		.pcpi_ready(pcpi_ready),
+		.pcpi_wait ((ENABLE_PCPI && pcpi_wait) || store_buffer_pcpi_wait),
+		.pcpi_ready((ENABLE_PCPI && pcpi_ready) || icache_pcpi_ready || store_buffer_pcpi_ready),
 
 		.irq(irq),
 		.eoi(eoi),
@@ -2993,7 +3927,53 @@ module picorv32_wb #(
 	reg [1:0] state;
 
 	wire we;
-	assign we = (mem_wstrb[0] | mem_wstrb[1] | mem_wstrb[2] | mem_wstrb[3]);
+	assign we = (icache_mem_wstrb[0] | icache_mem_wstrb[1] | icache_mem_wstrb[2] | icache_mem_wstrb[3]);
+
+	// With STORE_BUFFER_ENTRIES stores are acknowledged as soon as there is a free
+	// entry and written out when the bus is idle. After a read the oldest buffered
+	// store goes first (store_buffer_drain), so stores are not held back forever.
+	reg         store_buffer_posting;
+	reg         store_buffer_drain;
+
+	wire        store_buffer_st_valid = state == IDLE && icache_mem_valid && we;
+	wire        store_buffer_st_ready;
+	wire        store_buffer_wr_valid;
+	wire        store_buffer_wr_ready = state == WBSTART && store_buffer_posting && wbm_ack_i;
+	wire [31:0] store_buffer_wr_addr;
+	wire [31:0] store_buffer_wr_wdata;
+	wire [ 3:0] store_buffer_wr_wstrb;
+	wire        store_buffer_rd_hazard;
+
+	generate if (STORE_BUFFER_ENTRIES) begin:store_buffer
+		picorv32_store_buffer #(
+			.ENTRIES(STORE_BUFFER_ENTRIES),
+			.IO_ADDR(STORE_BUFFER_IO_ADDR)
+		) store_buffer (
+			.clk      (clk                   ),
+			.resetn   (resetn                ),
+			.st_valid (store_buffer_st_valid ),
+			.st_ready (store_buffer_st_ready ),
+			.st_addr  (icache_mem_addr       ),
+			.st_wdata (icache_mem_wdata      ),
+			.st_wstrb (icache_mem_wstrb      ),
+			.wr_valid (store_buffer_wr_valid ),
+			.wr_ready (store_buffer_wr_ready ),
+			.wr_addr  (store_buffer_wr_addr  ),
+			.wr_wdata (store_buffer_wr_wdata ),
+			.wr_wstrb (store_buffer_wr_wstrb ),
+			.rd_addr  (icache_mem_addr       ),
+			.rd_hazard(store_buffer_rd_hazard),
+			.empty    (store_buffer_empty    )
+		);
+	end else begin
+		assign store_buffer_st_ready = 0;
+		assign store_buffer_wr_valid = 0;
+		assign store_buffer_wr_addr = 0;
+		assign store_buffer_wr_wdata = 0;
+		assign store_buffer_wr_wstrb = 0;
+		assign store_buffer_rd_hazard = 0;
+		assign store_buffer_empty = 1;
+	end endgenerate
 
 	always @(posedge wb_clk_i) begin
 		if (wb_rst_i) begin
@@ -3004,20 +3984,39 @@ module picorv32_wb #(
 			wbm_stb_o <= 0;
 			wbm_cyc_o <= 0;
 			state <= IDLE;
+			store_buffer_posting <= 0;
+			store_buffer_drain <= 0;
 		end else begin
 			case (state)
 				IDLE: begin
-					if (mem_valid) begin
-						wbm_adr_o <= mem_addr;
-						wbm_dat_o <= mem_wdata;
+					if (STORE_BUFFER_ENTRIES && icache_mem_valid && we && store_buffer_st_ready) begin
+						icache_mem_ready <= 1'b1;
+
+						state <= WBEND;
+					end else
+					if (icache_mem_valid && !(STORE_BUFFER_ENTRIES && (we || store_buffer_rd_hazard ||
+							(store_buffer_drain && store_buffer_wr_valid)))) begin
+						wbm_adr_o <= icache_mem_addr;
+						wbm_dat_o <= icache_mem_wdata;
 						wbm_we_o <= we;
-						wbm_sel_o <= mem_wstrb;
+						wbm_sel_o <= icache_mem_wstrb;
+
+						wbm_stb_o <= 1'b1;
+						wbm_cyc_o <= 1'b1;
+						state <= WBSTART;
+					end else
+					if (store_buffer_wr_valid) begin
+						wbm_adr_o <= store_buffer_wr_addr;
+						wbm_dat_o <= store_buffer_wr_wdata;
+						wbm_we_o <= 1'b1;
+						wbm_sel_o <= store_buffer_wr_wstrb;
+						store_buffer_posting <= 1;
 
 						wbm_stb_o <= 1'b1;
 						wbm_cyc_o <= 1'b1;
 						state <= WBSTART;
 					end else begin
-						mem_ready <= 1'b0;
+						icache_mem_ready <= 1'b0;
 
 						wbm_stb_o <= 1'b0;
 						wbm_cyc_o <= 1'b0;
@@ -3026,10 +4025,14 @@ module picorv32_wb #(
 				end
 				WBSTART:begin
 					if (wbm_ack_i) begin
-						mem_rdata <= wbm_dat_i;
-						mem_ready <= 1'b1;
+						if (!store_buffer_posting) begin
+							icache_mem_rdata <= wbm_dat_i;
+							icache_mem_ready <= 1'b1;
+						end
+						store_buffer_posting <= 0;
+						store_buffer_drain <= !store_buffer_posting;
 
-						state <= WBEND;
+						state <= store_buffer_posting ? IDLE : WBEND;
 
 						wbm_stb_o <= 1'b0;
 						wbm_cyc_o <= 1'b0;
@@ -3037,7 +4040,7 @@ module picorv32_wb #(
 					end
 				end
 				WBEND: begin
-					mem_ready <= 1'b0;
+					icache_mem_ready <= 1'b0;
 
 					state <= IDLE;
 				end
@@ -77,6 +77,11 @@ module picosoc (
 	parameter [0:0] ENABLE_COUNTERS = 1;
 	parameter [0:0] ENABLE_IRQ_QREGS = 0;
 
+	// instruction cache for code executed from flash, disabled when ICACHE_SETS = 0
+	parameter integer ICACHE_SETS = 0;
+	parameter integer ICACHE_WAYS = 1;
+	parameter integer ICACHE_LINE_WORDS = 4;
+
 	parameter integer MEM_WORDS = 256;
 	parameter [31:0] STACKADDR = (4*MEM_WORDS);       // end of memory
 	parameter [31:0] PROGADDR_RESET = 32'h 0010_0000; // 1 MB into flash
@@ -103,6 +108,18 @@ module picosoc (
 	wire [3:0] mem_wstrb;
 	wire [31:0] mem_rdata;
 
+	wire cpu_mem_valid;
+	wire cpu_mem_instr;
+	wire cpu_mem_ready;
+	wire [31:0] cpu_mem_addr;
+	wire [31:0] cpu_mem_wdata;
+	wire [3:0] cpu_mem_wstrb;
+	wire [31:0] cpu_mem_rdata;
+
+	wire        pcpi_valid;
+	wire [31:0] pcpi_insn;
+	wire        pcpi_ready;
+
 	wire spimem_ready;
 	wire [31:0] spimem_rdata;
 
@@ -142,20 +159,69 @@ module picosoc (
 		.ENABLE_DIV(ENABLE_DIV),
 		.ENABLE_FAST_MUL(ENABLE_FAST_MUL),
 		.ENABLE_IRQ(1),
-		.ENABLE_IRQ_QREGS(ENABLE_IRQ_QREGS)
+		.ENABLE_IRQ_QREGS(ENABLE_IRQ_QREGS),
+		.ENABLE_PCPI(ICACHE_SETS != 0)
 	) cpu (
-		.clk         (clk        ),
-		.resetn      (resetn     ),
-		.mem_valid   (mem_valid  ),
-		.mem_instr   (mem_instr  ),
-		.mem_ready   (mem_ready  ),
-		.mem_addr    (mem_addr   ),
-		.mem_wdata   (mem_wdata  ),
-		.mem_wstrb   (mem_wstrb  ),
-		.mem_rdata   (mem_rdata  ),
-		.irq         (irq        )
+		.clk         (clk          ),
+		.resetn      (resetn       ),
+		.mem_valid   (cpu_mem_valid),
+		.mem_instr   (cpu_mem_instr),
+		.mem_ready   (cpu_mem_ready),
+		.mem_addr    (cpu_mem_addr ),
+		.mem_wdata   (cpu_mem_wdata),
+		.mem_wstrb   (cpu_mem_wstrb),
+		.mem_rdata   (cpu_mem_rdata),
+		.pcpi_valid  (pcpi_valid   ),
+		.pcpi_insn   (pcpi_insn    ),
+		.pcpi_wr     (1'b0         ),
+		.pcpi_rd     (32'b0        ),
+		.pcpi_wait   (1'b0         ),
+		.pcpi_ready  (pcpi_ready   ),
+		.irq         (irq          )
 	);
 
+	generate if (ICACHE_SETS != 0) begin:icache
+		// Only fetches from flash are cached, code in SRAM is executed uncached
+		// so that firmware can copy code there without an icflush.
+		picorv32_icache #(
+			.SETS      (ICACHE_SETS      ),
+			.WAYS      (ICACHE_WAYS      ),
+			.LINE_WORDS(ICACHE_LINE_WORDS)
+		) icache (
+			.clk          (clk          ),
+			.resetn       (resetn       ),
+			.mem_valid    (cpu_mem_valid),
+			.mem_instr    (cpu_mem_instr && cpu_mem_addr >= 4*MEM_WORDS && cpu_mem_addr < 32'h 0200_0000),
+			.mem_ready    (cpu_mem_ready),
+			.mem_addr     (cpu_mem_addr ),
+			.mem_wdata    (cpu_mem_wdata),
+			.mem_wstrb    (cpu_mem_wstrb),
+			.mem_rdata    (cpu_mem_rdata),
+			.ext_mem_valid(mem_valid    ),
+			.ext_mem_instr(mem_instr    ),
+			.ext_mem_ready(mem_ready    ),
+			.ext_mem_addr (mem_addr     ),
+			.ext_mem_wdata(mem_wdata    ),
+			.ext_mem_wstrb(mem_wstrb    ),
+			.ext_mem_rdata(mem_rdata    ),
+			.pcpi_valid   (pcpi_valid   ),
+			.pcpi_insn    (pcpi_insn    ),
+			.pcpi_wr      (             ),
+			.pcpi_rd      (             ),
+			.pcpi_wait    (             ),
+			.pcpi_ready   (pcpi_ready   )
+		);
+	end else begin
+		assign mem_valid = cpu_mem_valid;
+		assign mem_instr = cpu_mem_instr;
+		assign cpu_mem_ready = mem_ready;
+		assign mem_addr = cpu_mem_addr;
+		assign mem_wdata = cpu_mem_wdata;
+		assign mem_wstrb = cpu_mem_wstrb;
+		assign cpu_mem_rdata = mem_rdata;
+		assign pcpi_ready = 0;
+	end endgenerate
+
 	spimemio spimemio (
 		.clk    (clk),
 		.resetn (resetn),
@@ -0,0 +1,163 @@
+// Batch version of testbench.cc: runs many test cases in one process.
+//
+// Usage: obj_dir_batch/Vtestbench [+jobs=<n>] [+max_cycles=<n>] test1.hex test2.hex ...
+//
+// Each worker thread owns one Vtestbench model (built with -DBATCH, so the
+// memory and the console are modelled here) with its own VerilatedContext, and
+// reuses it for all the test cases it picks up: load the hex file, hold resetn
+// low for 100 cycles, run until trap. The console output of test.hex is written
+// to test.out, the same as "obj_dir/Vtestbench > output_sim.txt" without the
+// $finish line.
+
+#include "Vtestbench.h"
+#include "verilated.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct batch_memory
+{
+	std::vector<uint8_t> data;
+	std::string console;
+
+	batch_memory() : data(4*1024*1024) { }
+
+	// Read a hex file written by "objcopy -O verilog" (same as $readmemh in testbench.v).
+	bool load(const char *filename)
+	{
+		FILE *f = fopen(filename, "r");
+		if (f == NULL)
+			return false;
+		std::fill(data.begin(), data.end(), 0);
+		console.clear();
+		char buf[128];
+		size_t addr = 0;
+		while (fscanf(f, "%127s", buf) == 1) {
+			if (buf[0] == '@') {
+				addr = strtoul(buf+1, NULL, 16);
+				continue;
+			}
+			if (addr < data.size())
+				data[addr] = strtoul(buf, NULL, 16);
+			addr++;
+		}
+		fclose(f);
+		return true;
+	}
+
+	uint32_t read(uint32_t addr) const
+	{
+		uint32_t value = 0;
+		for (int i = 0; i < 4; i++)
+			if (addr + i < data.size())
+				value |= (uint32_t)data[addr + i] << (8*i);
+		return value;
+	}
+
+	void write(uint32_t addr, uint32_t wdata, uint8_t wstrb)
+	{
+		if (addr == 0x10000000) {
+			console += (char)(wdata & 0xff);
+			return;
+		}
+		for (int i = 0; i < 4; i++)
+			if (((wstrb >> i) & 1) && addr + i < data.size())
+				data[addr + i] = wdata >> (8*i);
+	}
+};
+
+// Run one test case, returns the number of cycles after reset or 0 on timeout.
+static uint64_t run_test(Vtestbench *top, batch_memory &mem, uint64_t max_cycles)
+{
+	top->resetn = 0;
+	for (uint64_t cycle = 0;; cycle++) {
+		if (cycle == 100)
+			top->resetn = 1;
+		if (cycle > 100 && top->trap)
+			return cycle - 100;
+		if (cycle == 100 + max_cycles)
+			return 0;
+
+		// the memory samples the bus before the clock edge, like the always block in testbench.v
+		if (top->mem_valid && top->mem_ready && top->mem_wstrb)
+			mem.write(top->mem_addr, top->mem_wdata, top->mem_wstrb);
+		top->clk = 1;
+		top->eval();
+		top->mem_rdata = mem.read(top->mem_addr);
+		top->eval();
+		top->clk = 0;
+		top->eval();
+	}
+}
+
+int main(int argc, char **argv, char **env)
+{
+	Verilated::commandArgs(argc, argv);
+
+	int jobs = std::thread::hardware_concurrency();
+	const char* flag_jobs = Verilated::commandArgsPlusMatch("jobs=");
+	if (flag_jobs && 0==strncmp(flag_jobs, "+jobs=", 6)) {
+		jobs = atoi(flag_jobs+6);
+	}
+	uint64_t max_cycles = 100000000;
+	const char* flag_max_cycles = Verilated::commandArgsPlusMatch("max_cycles=");
+	if (flag_max_cycles && 0==strncmp(flag_max_cycles, "+max_cycles=", 12)) {
+		max_cycles = strtoull(flag_max_cycles+12, NULL, 0);
+	}
+
+	std::vector<const char*> tests;
+	for (int i = 1; i < argc; i++)
+		if (argv[i][0] != '+')
+			tests.push_back(argv[i]);
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > (int)tests.size())
+		jobs = tests.size();
+
+	std::atomic<size_t> next_test(0);
+	std::atomic<int> failures(0);
+	std::vector<std::thread> workers;
+	for (int k = 0; k < jobs; k++) {
+		workers.push_back(std::thread([&]() {
+			std::unique_ptr<VerilatedContext> contextp(new VerilatedContext);
+			std::unique_ptr<Vtestbench> top(new Vtestbench(contextp.get()));
+			batch_memory mem;
+			for (size_t i; (i = next_test++) < tests.size();) {
+				std::string hex = tests[i];
+				if (!mem.load(hex.c_str())) {
+					printf("%s: failed to read\n", hex.c_str());
+					failures++;
+					continue;
+				}
+				uint64_t cycles = run_test(top.get(), mem, max_cycles);
+				std::string out = (hex.size() > 4 && hex.compare(hex.size() - 4, 4, ".hex") == 0 ?
+						hex.substr(0, hex.size() - 4) : hex) + ".out";
+				FILE *f = fopen(out.c_str(), "w");
+				if (f) {
+					fwrite(mem.console.data(), 1, mem.console.size(), f);
+					fclose(f);
+				}
+				if (cycles)
+					printf("%s: TRAP after %llu clock cycles\n", hex.c_str(), (unsigned long long)cycles);
+				else {
+					printf("%s: TIMEOUT after %llu clock cycles\n", hex.c_str(), (unsigned long long)max_cycles);
+					failures++;
+				}
+				fflush(stdout);
+			}
+			top->final();
+		}));
+	}
+	for (auto &w : workers)
+		w.join();
+
+	printf("%d test cases, %d timeouts or errors.\n", (int)tests.size(), (int)failures);
+	exit(failures ? 1 : 0);
+}
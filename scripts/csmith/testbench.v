@@ -3,6 +3,20 @@
 module testbench (
 `ifdef VERILATOR
 	input clk
+`ifdef BATCH
+	,
+	// Batch mode (see batch.cc): the memory and the console are modelled
+	// in C++, which also drives resetn between test cases.
+	input         resetn,
+	output        trap,
+	output        mem_valid,
+	output        mem_instr,
+	output        mem_ready,
+	output [31:0] mem_addr,
+	output [31:0] mem_wdata,
+	output [ 3:0] mem_wstrb,
+	input  [31:0] mem_rdata
+`endif
 `endif
 );
 `ifndef VERILATOR
@@ -10,6 +24,7 @@ module testbench (
 	always #5 clk = ~clk;
 `endif
 
+`ifndef BATCH
 	reg resetn = 0;
 	integer resetn_cnt = 0;
 	wire trap;
@@ -33,11 +48,17 @@ module testbench (
 	wire [31:0] mem_wdata;
 	wire [3:0] mem_wstrb;
 	wire [31:0] mem_rdata;
+`endif
 
 	reg [31:0] x32 = 314159265;
 	reg [31:0] next_x32;
 
 	always @(posedge clk) begin
+`ifdef BATCH
+		// models are reused, restart the stall pattern with every test case
+		if (!resetn)
+			x32 <= 314159265;
+`endif
 		if (resetn) begin
 			next_x32 = x32;
 			next_x32 = next_x32 ^ (next_x32 << 13);
@@ -64,11 +85,12 @@ module testbench (
 		.mem_rdata   (mem_rdata  )
 	);
 
+	assign mem_ready = x32[0] && mem_valid;
+
+`ifndef BATCH
 	reg [7:0] memory [0:4*1024*1024-1];
 	initial $readmemh("test.hex", memory);
 
-	assign mem_ready = x32[0] && mem_valid;
-
 	assign mem_rdata[ 7: 0] = memory[mem_addr + 0];
 	assign mem_rdata[15: 8] = memory[mem_addr + 1];
 	assign mem_rdata[23:16] = memory[mem_addr + 2];
@@ -97,4 +119,5 @@ module testbench (
 			$finish;
 		end
 	end
+`endif
 endmodule
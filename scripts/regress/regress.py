@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+#
+# Run a set of ELF images on the Verilator test bench in parallel, one process
+# per image, and collect the results as JSON and/or JUnit XML.
+#
+# Usage: python3 regress.py [-j jobs] [-t timeout] [--json file] [--junit file] testbench elf...
+
+import argparse, json, os, re, subprocess, sys, time
+from concurrent.futures import ThreadPoolExecutor
+from xml.sax.saxutils import escape, quoteattr
+
+parser = argparse.ArgumentParser(description="Parallel regression runner for the Verilator test bench.")
+parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(), help="number of parallel simulations")
+parser.add_argument("-t", "--timeout", type=float, default=60, help="timeout per test in seconds")
+parser.add_argument("--json", help="write results as JSON to this file")
+parser.add_argument("--junit", help="write results as JUnit XML to this file")
+parser.add_argument("testbench", help="test bench executable (e.g. ../../testbench_verilator)")
+parser.add_argument("elfs", nargs="+", help="ELF images to run")
+args = parser.parse_args()
+
+def run_test(elf):
+    name = os.path.splitext(os.path.basename(elf))[0]
+    start = time.monotonic()
+    try:
+        proc = subprocess.run([args.testbench, "+elf=" + elf], stdout=subprocess.PIPE,
+                stderr=subprocess.STDOUT, timeout=args.timeout)
+        output = proc.stdout.decode("utf-8", "replace")
+        returncode = proc.returncode
+    except subprocess.TimeoutExpired as e:
+        output = (e.stdout or b"").decode("utf-8", "replace") + "\nTIMEOUT after %g s\n" % args.timeout
+        returncode = None
+    wall = time.monotonic() - start
+
+    cycles = None
+    match = re.search(r"^(?:TOHOST|TRAP) after (\d+) clock cycles", output, re.M)
+    if match: cycles = int(match.group(1))
+
+    if returncode is None:
+        status = "timeout"
+    elif returncode == 0 and "ALL TESTS PASSED." in output:
+        status = "pass"
+    else:
+        status = "fail"
+
+    failed_test = None
+    match = re.search(r"^ERROR! tohost = \S+ \(test (\d+) failed\)", output, re.M)
+    if match: failed_test = int(match.group(1))
+
+    return {"name": name, "elf": elf, "status": status, "cycles": cycles, "wall_time": round(wall, 3),
+            "failed_test": failed_test, "output": output}
+
+start = time.monotonic()
+with ThreadPoolExecutor(max_workers=max(args.jobs, 1)) as pool:
+    results = []
+    for result in pool.map(run_test, args.elfs):
+        print("%-8s %-20s %10s cycles %8.3f s" % (result["status"].upper(), result["name"],
+                "-" if result["cycles"] is None else result["cycles"], result["wall_time"]))
+        if result["status"] != "pass":
+            sys.stdout.write(result["output"])
+        sys.stdout.flush()
+        results.append(result)
+wall = time.monotonic() - start
+
+failures = [r for r in results if r["status"] != "pass"]
+print("%d tests, %d passed, %d failed, %.3f s" % (len(results), len(results) - len(failures), len(failures), wall))
+
+if args.json:
+    with open(args.json, "w") as f:
+        json.dump({"testbench": args.testbench, "wall_time": round(wall, 3),
+                "tests": [{k: v for k, v in r.items() if k != "output"} for r in results]}, f, indent=2)
+        f.write("\n")
+
+if args.junit:
+    with open(args.junit, "w") as f:
+        f.write('<?xml version="1.0" encoding="UTF-8"?>\n')
+        f.write('<testsuite name="picorv32" tests="%d" failures="%d" time="%.3f">\n' % (len(results), len(failures), wall))
+        for r in results:
+            f.write('  <testcase classname="picorv32" name=%s time="%.3f">\n' % (quoteattr(r["name"]), r["wall_time"]))
+            if r["cycles"] is not None:
+                f.write('    <properties><property name="cycles" value="%d"/></properties>\n' % r["cycles"])
+            if r["status"] != "pass":
+                message = r["status"] if r["failed_test"] is None else "test %d failed" % r["failed_test"]
+                f.write('    <failure message=%s>%s</failure>\n' % (quoteattr(message), escape(r["output"])))
+            f.write('  </testcase>\n')
+        f.write('</testsuite>\n')
+
+sys.exit(1 if failures else 0)
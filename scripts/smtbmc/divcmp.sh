@@ -0,0 +1,17 @@
+#!/bin/bash
+
+set -ex
+
+# STEPS_AT_ONCE and EARLY_OUT of the second divider, 3 does not divide 32
+for cfg in "4 1" "4 0" "3 1" "3 0"; do
+	set -- $cfg
+
+	yosys -ql divcmp.yslog \
+	        -p 'read_verilog -formal -norestrict -assume-asserts ../../picorv32.v' \
+	        -p 'read_verilog -formal divcmp.v' \
+		-p "chparam -set STEPS_AT_ONCE $1 -set EARLY_OUT $2 testbench" \
+		-p 'prep -top testbench -nordff' \
+		-p 'write_smt2 -wires divcmp.smt2'
+
+	yosys-smtbmc -s yices -t 100 --dump-vcd output.vcd --dump-smtc output.smtc divcmp.smt2
+done
@@ -0,0 +1,14 @@
+#!/bin/bash
+
+set -ex
+
+for ffs in 0 1; do
+	yosys -ql mulcmp2.yslog \
+	        -p 'read_verilog -formal -norestrict -assume-asserts ../../picorv32.v' \
+	        -p 'read_verilog -formal mulcmp2.v' \
+		-p "chparam -set EXTRA_MUL_FFS $ffs testbench" \
+		-p 'prep -top testbench -nordff' \
+		-p 'write_smt2 -wires mulcmp2.smt2'
+
+	yosys-smtbmc -s yices -t 20 --dump-vcd output.vcd --dump-smtc output.smtc mulcmp2.smt2
+done
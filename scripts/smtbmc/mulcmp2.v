@@ -0,0 +1,111 @@
+// Check FUSE_MULH in picorv32_pcpi_fast_mul: both multipliers execute the same
+// two multiplies back to back, the second one with operands that may or may not
+// match the first one (e.g. MULH[[S]U] rdh, rs1, rs2; MUL rdl, rs1, rs2).
+
+module testbench(input clk);
+	parameter EXTRA_MUL_FFS = 0;
+
+	reg resetn = 0;
+
+	always @(posedge clk)
+		resetn <= 1;
+
+	wire [1:0] funct3_a = $anyconst;
+	wire [1:0] funct3_b = $anyconst;
+	wire [31:0] rs1_a = $anyconst;
+	wire [31:0] rs2_a = $anyconst;
+	wire [31:0] rs1_b = $anyconst;
+	wire [31:0] rs2_b = $anyconst;
+
+	wire [31:0] insn_a = {7'b0000001, 10'b0, 1'b0, funct3_a, 5'b0, 7'b0110011};
+	wire [31:0] insn_b = {7'b0000001, 10'b0, 1'b0, funct3_b, 5'b0, 7'b0110011};
+
+	// step: 0 = first multiply, 1 = gap, 2 = second multiply, 3 = done
+	reg [1:0] step_0 = 0, step_1 = 0;
+	reg [31:0] rd_a_0, rd_a_1, rd_b_0, rd_b_1;
+
+	wire        pcpi_valid_0 = resetn && (step_0 == 0 || step_0 == 2);
+	wire [31:0] pcpi_insn_0 = step_0 ? insn_b : insn_a;
+	wire [31:0] pcpi_rs1_0 = step_0 ? rs1_b : rs1_a;
+	wire [31:0] pcpi_rs2_0 = step_0 ? rs2_b : rs2_a;
+
+	wire        pcpi_valid_1 = resetn && (step_1 == 0 || step_1 == 2);
+	wire [31:0] pcpi_insn_1 = step_1 ? insn_b : insn_a;
+	wire [31:0] pcpi_rs1_1 = step_1 ? rs1_b : rs1_a;
+	wire [31:0] pcpi_rs2_1 = step_1 ? rs2_b : rs2_a;
+
+	wire        pcpi_wr_0;
+	wire [31:0] pcpi_rd_0;
+	wire        pcpi_wait_0;
+	wire        pcpi_ready_0;
+
+	wire        pcpi_wr_1;
+	wire [31:0] pcpi_rd_1;
+	wire        pcpi_wait_1;
+	wire        pcpi_ready_1;
+
+	picorv32_pcpi_fast_mul #(
+		.EXTRA_MUL_FFS(EXTRA_MUL_FFS)
+	) mul_0 (
+		.clk       (clk         ),
+		.resetn    (resetn      ),
+		.pcpi_valid(pcpi_valid_0),
+		.pcpi_insn (pcpi_insn_0 ),
+		.pcpi_rs1  (pcpi_rs1_0  ),
+		.pcpi_rs2  (pcpi_rs2_0  ),
+		.pcpi_wr   (pcpi_wr_0   ),
+		.pcpi_rd   (pcpi_rd_0   ),
+		.pcpi_wait (pcpi_wait_0 ),
+		.pcpi_ready(pcpi_ready_0)
+	);
+
+	picorv32_pcpi_fast_mul #(
+		.EXTRA_MUL_FFS(EXTRA_MUL_FFS),
+		.FUSE_MULH(1)
+	) mul_1 (
+		.clk       (clk         ),
+		.resetn    (resetn      ),
+		.pcpi_valid(pcpi_valid_1),
+		.pcpi_insn (pcpi_insn_1 ),
+		.pcpi_rs1  (pcpi_rs1_1  ),
+		.pcpi_rs2  (pcpi_rs2_1  ),
+		.pcpi_wr   (pcpi_wr_1   ),
+		.pcpi_rd   (pcpi_rd_1   ),
+		.pcpi_wait (pcpi_wait_1 ),
+		.pcpi_ready(pcpi_ready_1)
+	);
+
+	always @(posedge clk) begin
+		if (resetn) begin
+			if (step_0 == 1 || step_0 == 3)
+				assert(!pcpi_ready_0);
+			if (step_1 == 1 || step_1 == 3)
+				assert(!pcpi_ready_1);
+
+			if (step_0 == 1 || pcpi_ready_0) begin
+				step_0 <= step_0 + 1;
+				if (step_0 == 0)
+					rd_a_0 <= pcpi_rd_0;
+				if (step_0 == 2)
+					rd_b_0 <= pcpi_rd_0;
+			end
+
+			if (step_1 == 1 || pcpi_ready_1) begin
+				step_1 <= step_1 + 1;
+				if (step_1 == 0)
+					rd_a_1 <= pcpi_rd_1;
+				if (step_1 == 2)
+					rd_b_1 <= pcpi_rd_1;
+			end
+
+			if (pcpi_ready_1)
+				assert(pcpi_wr_1);
+
+			if (step_0 > 0 && step_1 > 0)
+				assert(rd_a_0 == rd_a_1);
+
+			if (step_0 == 3 && step_1 == 3)
+				assert(rd_b_0 == rd_b_1);
+		end
+	end
+endmodule
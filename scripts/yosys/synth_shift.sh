@@ -0,0 +1,11 @@
+#!/bin/bash
+# Compare the iCE40 resource usage of the shifter options: the single bit shifter
+# (TWO_STAGE_SHIFT = 0), the default TWO_STAGE_SHIFT, LOG_SHIFTER and BARREL_SHIFTER.
+# TWO_STAGE_SHIFT is cleared for BARREL_SHIFTER, whose core never enters the shift state.
+set -ex
+cd "$(dirname "$0")"
+for cfg in SINGLE:"-set TWO_STAGE_SHIFT 0" TWO_STAGE_SHIFT:"-set TWO_STAGE_SHIFT 1" \
+		LOG_SHIFTER:"-set LOG_SHIFTER 1" BARREL_SHIFTER:"-set BARREL_SHIFTER 1 -set TWO_STAGE_SHIFT 0"; do
+	yosys -ql synth_shift_${cfg%%:*}.log -p "read_verilog ../../picorv32.v; chparam ${cfg#*:} picorv32; synth_ice40 -top picorv32; stat"
+done
+grep -H 'SB_LUT4\|SB_DFF\|SB_CARRY' synth_shift_*.log
@@ -0,0 +1,170 @@
+// Native version of showtrace.py. Decodes a trace written by the test bench
+// (text or the compressed binary format from testbench_trace.h) against the
+// disassembly of the firmware ELF file and prints the same listing as
+// "python3 showtrace.py <trace> <elf>".
+//
+// Usage: ./showtrace <trace> <elf> [<progaddr_irq>]
+// The disassembler defaults to riscv32-unknown-elf-objdump, set OBJDUMP to override.
+// IRQ handlers are decoded from progaddr_irq (default 0x10), unless the trace has
+// the IRQ entry records written by cores with ENABLE_IRQ_VECTOR.
+
+#include "testbench_trace.h"
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <string>
+#include <unordered_map>
+
+struct insn_info
+{
+	uint32_t opcode;
+	std::string desc, opname;
+};
+
+static bool is_one_of(const std::string &s, const char *const *list)
+{
+	for (; *list; list++)
+		if (s == *list)
+			return true;
+	return false;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3 && argc != 4) {
+		fprintf(stderr, "Usage: %s <trace> <elf> [<progaddr_irq>]\n", argv[0]);
+		return 1;
+	}
+	uint32_t progaddr_irq = argc == 4 ? strtoul(argv[3], NULL, 0) : 0x10;
+
+	std::unordered_map<uint32_t, insn_info> insns;
+
+	const char *objdump = getenv("OBJDUMP");
+	std::string cmd = std::string(objdump ? objdump : "riscv32-unknown-elf-objdump") + " -d '" + argv[2] + "'";
+	FILE *p = popen(cmd.c_str(), "r");
+	if (p == NULL) {
+		perror("popen");
+		return 1;
+	}
+	char line[1024];
+	while (fgets(line, sizeof(line), p)) {
+		// ^\s*([0-9a-f]+):\s+([0-9a-f]+)\s*(.*)
+		char *s = line, *e;
+		while (isspace(*s)) s++;
+		uint32_t addr = strtoul(s, &e, 16);
+		if (e == s || *e != ':' || (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')))
+			continue;
+		s = e + 1;
+		if (!isspace(*s))
+			continue;
+		while (isspace(*s)) s++;
+		uint32_t opcode = strtoul(s, &e, 16);
+		if (e == s || (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')))
+			continue;
+		s = e;
+		while (isspace(*s)) s++;
+		insn_info &info = insns[addr];
+		info.opcode = opcode;
+		info.desc = s;
+		while (!info.desc.empty() && (info.desc.back() == '\n' || info.desc.back() == '\r'))
+			info.desc.pop_back();
+		for (char &c : info.desc)
+			if (c == '\t') c = ' ';
+		size_t b = info.desc.find_first_not_of(' '), l = info.desc.find(' ', b);
+		info.opname = b == std::string::npos ? "" : info.desc.substr(b, l == std::string::npos ? l : l - b);
+		if (opcode == 0x0400000b)
+			info.desc = info.opname = "retirq";
+	}
+	pclose(p);
+
+	trace_reader trace;
+	if (!trace.open(argv[1])) {
+		fprintf(stderr, "Failed to open %s.\n", argv[1]);
+		return 1;
+	}
+
+	static const char *const branch_ops[] = { "j", "jal", "jr", "jalr", "ret", "retirq",
+			"beq", "bne", "blt", "ble", "bge", "bgt", "bltu", "bleu", "bgeu", "bgtu",
+			"beqz", "bnez", "blez", "bgez", "bltz", "bgtz", NULL };
+	static const char *const cond_branch_ops[] = {
+			"beq", "bne", "blt", "ble", "bge", "bgt", "bltu", "bleu", "bgeu", "bgtu",
+			"beqz", "bnez", "blez", "bgez", "bltz", "bgtz", NULL };
+	static const char *const addr_ops[] = { "lb", "lh", "lw", "lbu", "lhu", "sb", "sh", "sw", NULL };
+
+	static char outbuf[1 << 20];
+	setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+	int64_t pc = -1;
+	bool last_irq = false;
+	uint64_t num_branches = 0, num_mispredicts = 0;
+	uint64_t raw_data;
+	while (trace.read(raw_data)) {
+		uint32_t payload = raw_data & 0xffffffff;
+		bool irq_active = (raw_data & 0x800000000ULL) != 0;
+		bool is_addr = (raw_data & 0x200000000ULL) != 0;
+		bool is_branch = (raw_data & 0x100000000ULL) != 0;
+		bool is_mispredict = (raw_data & 0x400000000ULL) != 0;
+		char info[32];
+		snprintf(info, sizeof(info), "%s %s%08x", irq_active || last_irq ? "IRQ" : "   ",
+				is_branch ? ">" : is_addr ? "@" : "=", payload);
+
+		if (irq_active && !last_irq) {
+			// IRQ entry record (ENABLE_IRQ_VECTOR), the payload is the address of the handler
+			if (is_addr && is_branch) {
+				printf("%s ** IRQ ENTRY **\n", info);
+				pc = payload;
+				last_irq = irq_active;
+				continue;
+			}
+			pc = progaddr_irq;
+		}
+
+		if (pc >= 0) {
+			auto it = insns.find(pc);
+			if (it != insns.end()) {
+				const insn_info &insn = it->second;
+
+				if (is_branch && !is_one_of(insn.opname, branch_ops))
+					printf("%s ** UNEXPECTED BRANCH DATA FOR INSN AT %08x! **\n", info, (uint32_t)pc);
+
+				if (is_addr && !is_one_of(insn.opname, addr_ops))
+					printf("%s ** UNEXPECTED ADDR DATA FOR INSN AT %08x! **\n", info, (uint32_t)pc);
+
+				if (is_one_of(insn.opname, cond_branch_ops))
+					num_branches++;
+				if (is_mispredict)
+					num_mispredicts++;
+
+				if ((insn.opcode & 3) == 3)
+					printf("%s | %08x | %08x | %s%s\n", info, (uint32_t)pc, insn.opcode, insn.desc.c_str(),
+							is_mispredict ? " (mispredicted)" : "");
+				else
+					printf("%s | %08x |     %04x | %s%s\n", info, (uint32_t)pc, insn.opcode, insn.desc.c_str(),
+							is_mispredict ? " (mispredicted)" : "");
+				if (!is_addr)
+					pc += (insn.opcode & 3) == 3 ? 4 : 2;
+			} else {
+				printf("%s ** NO INFORMATION ON INSN AT %08x! **\n", info, (uint32_t)pc);
+				pc = -1;
+			}
+		} else {
+			if (is_branch)
+				printf("%s ** FOUND BRANCH AND STARTING DECODING **\n", info);
+			else
+				printf("%s ** SKIPPING DATA UNTIL NEXT BRANCH **\n", info);
+		}
+
+		if (is_branch)
+			pc = payload;
+
+		last_irq = irq_active;
+	}
+
+	// TRACE_MISPREDICT is only set by cores with BRANCH_PREDICT
+	if (num_mispredicts)
+		printf("%llu conditional branches, %llu mispredicted, prediction accuracy %.1f%%\n",
+				(unsigned long long)num_branches, (unsigned long long)num_mispredicts,
+				100.0 * (num_branches - num_mispredicts) / num_branches);
+
+	return 0;
+}
@@ -4,6 +4,8 @@ import sys, re, subprocess
 
 trace_filename = sys.argv[1]
 elf_filename = sys.argv[2]
+# IRQ handlers start here, unless the trace has IRQ entry records (ENABLE_IRQ_VECTOR)
+progaddr_irq = int(sys.argv[3], 0) if len(sys.argv) > 3 else 0x10
 
 insns = dict()
 
@@ -14,6 +16,11 @@ with subprocess.Popen(["riscv32-unknown-elf-objdump", "-d", elf_filename], stdou
         match = re.match(r'^\s*([0-9a-f]+):\s+([0-9a-f]+)\s*(.*)', line)
         if match: insns[int(match.group(1), 16)] = (int(match.group(2), 16), match.group(3).replace("\t", " "))
 
+cond_branches = ["beq", "bne", "blt", "ble", "bge", "bgt", "bltu", "bleu", "bgeu", "bgtu",
+        "beqz", "bnez", "blez", "bgez", "bltz", "bgtz"]
+num_branches = 0
+num_mispredicts = 0
+
 with open(trace_filename, "r") as f:
     pc = -1
     last_irq = False
@@ -23,11 +30,18 @@ with open(trace_filename, "r") as f:
         irq_active = (raw_data & 0x800000000) != 0
         is_addr = (raw_data & 0x200000000) != 0
         is_branch = (raw_data & 0x100000000) != 0
+        is_mispredict = (raw_data & 0x400000000) != 0
         info = "%s %s%08x" % ("IRQ" if irq_active or last_irq else "   ",
                 ">" if is_branch else "@" if is_addr else "=", payload)
 
         if irq_active and not last_irq:
-            pc = 0x10
+            # IRQ entry record (ENABLE_IRQ_VECTOR), the payload is the address of the handler
+            if is_addr and is_branch:
+                print("%s ** IRQ ENTRY **" % info)
+                pc = payload
+                last_irq = irq_active
+                continue
+            pc = progaddr_irq
 
         if pc >= 0:
             if pc in insns:
@@ -38,11 +52,15 @@ with open(trace_filename, "r") as f:
                     insn_desc = "retirq"
                     opname = "retirq"
 
-                if is_branch and opname not in ["j", "jal", "jr", "jalr", "ret", "retirq",
-                        "beq", "bne", "blt", "ble", "bge", "bgt", "bltu", "bleu", "bgeu", "bgtu",
-                        "beqz", "bnez", "blez", "bgez", "bltz", "bgtz"]:
+                if is_branch and opname not in ["j", "jal", "jr", "jalr", "ret", "retirq"] + cond_branches:
                     print("%s ** UNEXPECTED BRANCH DATA FOR INSN AT %08x! **" % (info, pc))
 
+                if opname in cond_branches:
+                    num_branches += 1
+                if is_mispredict:
+                    num_mispredicts += 1
+                    insn_desc += " (mispredicted)"
+
                 if is_addr and opname not in ["lb", "lh", "lw", "lbu", "lhu", "sb", "sh", "sw"]:
                     print("%s ** UNEXPECTED ADDR DATA FOR INSN AT %08x! **" % (info, pc))
 
@@ -64,3 +82,8 @@ with open(trace_filename, "r") as f:
 
         last_irq = irq_active
 
+# TRACE_MISPREDICT is only set by cores with BRANCH_PREDICT
+if num_mispredicts:
+    print("%d conditional branches, %d mispredicted, prediction accuracy %.1f%%" % (num_branches,
+            num_mispredicts, 100.0 * (num_branches - num_mispredicts) / num_branches))
+
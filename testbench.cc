@@ -1,5 +1,543 @@
 #include "Vpicorv32_wrapper.h"
+#include "verilated_syms.h"
+#if VM_TRACE_FST
+#include "verilated_fst_c.h"
+#else
 #include "verilated_vcd_c.h"
+#endif
+#ifdef TESTBENCH_SAVABLE
+#include "verilated_save.h"
+#endif
+#include "testbench_elf.h"
+#include "testbench_gmon.h"
+#include "testbench_iss.h"
+#include "testbench_profile.h"
+#include "testbench_trace.h"
+#include "testbench_writer.h"
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+static double wall_time()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+#if VM_TRACE_FST
+// FST has its own compression thread (and with --trace-threads an extra thread for the dump itself).
+struct fst_tracer : public VerilatedFstC
+{
+	void open_ring(const char *filename) { open(filename); }
+	void next_segment() { }
+	void finish() { close(); }
+};
+
+typedef fst_tracer tracer_t;
+#define TRACE_FILENAME "testbench.fst"
+#else
+// VCD output file that does the write() calls on a background thread.
+//
+// In ring mode (+vcd_ring) nothing is written until finish_ring(). The file
+// keeps the header and the two most recent segments in memory, and every call
+// to VerilatedVcdC::openNext() starts a new segment. Verilator begins each
+// segment with a full dump, so header + older + newer segment is a valid VCD.
+struct async_vcd_file : public VerilatedVcdFile
+{
+	int fd;
+	async_writer *writer;
+	bool ring, ring_started;
+	std::string ring_header, ring_segment[2];
+	int ring_cur;
+
+	async_vcd_file() : fd(-1), writer(NULL), ring(false), ring_started(false), ring_cur(0) { }
+
+	virtual bool open(const std::string &name)
+	{
+		if (ring && fd >= 0) {
+			ring_cur ^= 1;
+			ring_segment[ring_cur].clear();
+			return true;
+		}
+		fd = ::open(name.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0666);
+		if (fd < 0)
+			return false;
+		int out = fd;
+		writer = new async_writer([out](const uint8_t *data, size_t len) {
+			while (len > 0) {
+				ssize_t n = ::write(out, data, len);
+				if (n <= 0)
+					break;
+				data += n;
+				len -= n;
+			}
+		});
+		return true;
+	}
+
+	virtual void close()
+	{
+		if (ring)
+			return;
+		delete writer;
+		writer = NULL;
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+	}
+
+	virtual ssize_t write(const char *bufp, ssize_t len)
+	{
+		if (!ring)
+			writer->put(bufp, len);
+		else if (!ring_started)
+			ring_header.append(bufp, len);
+		else
+			ring_segment[ring_cur].append(bufp, len);
+		return len;
+	}
+
+	void finish_ring()
+	{
+		ring = false;
+		writer->put(ring_header.data(), ring_header.size());
+		writer->put(ring_segment[ring_cur ^ 1].data(), ring_segment[ring_cur ^ 1].size());
+		writer->put(ring_segment[ring_cur].data(), ring_segment[ring_cur].size());
+		close();
+	}
+};
+
+struct async_vcd : public VerilatedVcdC
+{
+	async_vcd_file file;
+	async_vcd() : VerilatedVcdC(&file) { }
+
+	void open_ring(const char *filename)
+	{
+		file.ring = true;
+		open(filename);
+		flush();
+		file.ring_started = true;
+	}
+
+	void next_segment() { openNext(false); }
+
+	void finish()
+	{
+		close();
+		if (file.ring)
+			file.finish_ring();
+	}
+};
+
+typedef async_vcd tracer_t;
+#define TRACE_FILENAME "testbench.vcd"
+#endif
+
+#ifdef TESTBENCH_SAVABLE
+// Checkpoints (+save/+restore) use the same code for both directions.
+static void checkpoint_io(VerilatedSerialize &os, void *data, size_t len) { os.write(data, len); }
+static void checkpoint_io(VerilatedDeserialize &os, void *data, size_t len) { os.read(data, len); }
+#endif
+
+// Verilated::commandArgsPlusMatch() returns the first argument that starts with
+// the given text, so e.g. "+trace" would also find "+trace_zst". This checks
+// for an exact match.
+static bool plusarg_flag(int argc, char **argv, const char *flag)
+{
+	for (int i = 1; i < argc; i++)
+		if (0==strcmp(argv[i], flag))
+			return true;
+	return false;
+}
+
+// C++ version of the axi4_memory module in testbench.v. The negedge() and
+// posedge() methods follow the two always blocks there, including their
+// blocking/non-blocking split, so cycle counts match the Icarus test bench.
+// With +axi_test the stall pattern is drawn from the same xorshift64 sequence,
+// the seed can be changed with +axi_seed=<n>.
+// For ELF images with a "tohost" symbol, the first non-zero word written there
+// ends the simulation: 1 means pass, any other value is (failed_test << 1) | 1.
+struct axi4_memory
+{
+	Vpicorv32_wrapper *top;
+	std::vector<uint32_t> memory;
+	bool verbose, axi_test;
+
+	uint64_t xorshift64_state;
+	uint8_t async_axi_transaction, delay_axi_transaction;
+
+	bool latched_raddr_en, latched_waddr_en, latched_wdata_en;
+	bool fast_raddr, fast_waddr, fast_wdata;
+	uint32_t latched_raddr, latched_waddr, latched_wdata;
+	uint8_t latched_wstrb;
+	bool latched_rinsn;
+
+	// outputs (registered) and their non-blocking updates
+	bool arready, awready, wready, bvalid, rvalid;
+	uint32_t rdata;
+	bool next_arready, next_awready, next_wready, next_bvalid, next_rvalid;
+	uint32_t next_rdata;
+	bool next_fast_raddr, next_fast_waddr, next_fast_wdata;
+	bool tests_passed;
+
+	bool tohost_enabled;
+	uint32_t tohost_addr, tohost_value;
+
+	axi4_memory(Vpicorv32_wrapper *top, size_t size, bool verbose, bool axi_test, uint64_t seed) :
+			top(top), memory(size / 4), verbose(verbose), axi_test(axi_test), xorshift64_state(seed),
+			async_axi_transaction(~0), delay_axi_transaction(0),
+			latched_raddr_en(0), latched_waddr_en(0), latched_wdata_en(0),
+			fast_raddr(0), fast_waddr(0), fast_wdata(0),
+			latched_raddr(0), latched_waddr(0), latched_wdata(0), latched_wstrb(0), latched_rinsn(0),
+			arready(0), awready(0), wready(0), bvalid(0), rvalid(0), rdata(0), tests_passed(0),
+			tohost_enabled(0), tohost_addr(0), tohost_value(0)
+	{
+	}
+
+	// The memory must end below the console and test result ports at 0x10000000 and 0x20000000.
+	static const size_t max_size = 0x10000000;
+
+	size_t size() const { return memory.size() * 4; }
+
+#ifdef TESTBENCH_SAVABLE
+	// Save or restore the memory contents and everything above except the configuration.
+	template <class S> void checkpoint(S &os)
+	{
+		uint64_t words = memory.size();
+		checkpoint_io(os, &words, sizeof(words));
+		memory.resize(words);
+		checkpoint_io(os, memory.data(), words * 4);
+#define CHECKPOINT(field) checkpoint_io(os, &field, sizeof(field));
+		CHECKPOINT(xorshift64_state)
+		CHECKPOINT(async_axi_transaction) CHECKPOINT(delay_axi_transaction)
+		CHECKPOINT(latched_raddr_en) CHECKPOINT(latched_waddr_en) CHECKPOINT(latched_wdata_en)
+		CHECKPOINT(fast_raddr) CHECKPOINT(fast_waddr) CHECKPOINT(fast_wdata)
+		CHECKPOINT(latched_raddr) CHECKPOINT(latched_waddr) CHECKPOINT(latched_wdata)
+		CHECKPOINT(latched_wstrb) CHECKPOINT(latched_rinsn)
+		CHECKPOINT(arready) CHECKPOINT(awready) CHECKPOINT(wready) CHECKPOINT(bvalid) CHECKPOINT(rvalid)
+		CHECKPOINT(rdata) CHECKPOINT(tests_passed)
+		CHECKPOINT(tohost_enabled) CHECKPOINT(tohost_addr) CHECKPOINT(tohost_value)
+#undef CHECKPOINT
+	}
+#endif
+
+	bool load_hex(const char *filename)
+	{
+		FILE *f = fopen(filename, "r");
+		if (f == NULL)
+			return false;
+		char buf[128];
+		size_t addr = 0;
+		while (fscanf(f, "%127s", buf) == 1) {
+			if (buf[0] == '/' && buf[1] == '/') {
+				fscanf(f, "%*[^\n]");
+				continue;
+			}
+			if (buf[0] == '@') {
+				addr = strtoul(buf+1, NULL, 16);
+				continue;
+			}
+			if (addr < memory.size())
+				memory[addr] = strtoul(buf, NULL, 16);
+			addr++;
+		}
+		fclose(f);
+		return true;
+	}
+
+	bool load_elf(const char *filename)
+	{
+		elf_file elf;
+		if (!elf.open(filename))
+			return false;
+		uint64_t end = elf.load_end();
+		if (end > max_size) {
+			printf("%s is linked up to 0x%llx, but the memory has to end below the I/O ports at 0x%zx.\n",
+					filename, (unsigned long long)end, max_size);
+			return false;
+		}
+		if (end > size()) {
+			printf("Growing memory to %llu bytes for %s.\n", (unsigned long long)(end + 3) & ~3ULL, filename);
+			memory.resize((end + 3) / 4);
+		}
+		if (!elf.load((uint8_t*)memory.data(), size()))
+			return false;
+
+		// The core always starts at PROGADDR_RESET (0 in picorv32_wrapper). If the
+		// entry point is elsewhere and the reset vector is unused, jump to it from there.
+		uint32_t entry = elf.entry();
+		if (entry != 0) {
+			if (memory[0] == 0 && memory[1] == 0) {
+				uint32_t hi = (entry + 0x800) & 0xfffff000, lo = entry - hi;
+				memory[0] = hi | (5 << 7) | 0x37;  // lui t0, %hi(entry)
+				memory[1] = (lo << 20) | (5 << 15) | 0x67;  // jalr zero, %lo(entry)(t0)
+			} else
+				printf("Warning: ignoring ELF entry point %08x, execution starts at 0.\n", entry);
+		}
+
+		tohost_enabled = elf.lookup("tohost", tohost_addr);
+		return true;
+	}
+
+	// Memory and I/O accesses, shared by the AXI handshake below and the ISS.
+	// Both return false for addresses outside of the memory and the I/O ports.
+	bool read_word(uint32_t addr, uint32_t &data) const
+	{
+		if (addr >= size())
+			return false;
+		data = memory[addr >> 2];
+		return true;
+	}
+
+	bool write_word(uint32_t addr, uint32_t data, uint8_t wstrb)
+	{
+		if (tohost_enabled && addr == tohost_addr && data != 0) {
+			tohost_value = data;
+			if (tohost_value == 1)
+				tests_passed = 1;
+		}
+		if (addr < size()) {
+			uint32_t &word = memory[addr >> 2];
+			for (int i = 0; i < 4; i++)
+				if ((wstrb >> i) & 1)
+					word = (word & ~(0xffu << (8*i))) | (data & (0xffu << (8*i)));
+		} else
+		if (addr == 0x10000000) {
+			if (verbose) {
+				if (32 <= data && data < 128)
+					printf("OUT: '%c'\n", data);
+				else
+					printf("OUT: %3d\n", data);
+			} else {
+				printf("%c", data & 0xff);
+				fflush(stdout);
+			}
+		} else
+		if (addr == 0x20000000) {
+			if (data == 123456789)
+				tests_passed = 1;
+		} else
+			return false;
+		return true;
+	}
+
+	// Drop all outstanding AXI transactions, used when the core is reset
+	// in the middle of a simulation to hand over from the ISS.
+	void reset_bus()
+	{
+		latched_raddr_en = latched_waddr_en = latched_wdata_en = 0;
+		fast_raddr = fast_waddr = fast_wdata = 0;
+		arready = awready = wready = bvalid = rvalid = 0;
+	}
+
+	void handle_axi_arvalid()
+	{
+		next_arready = 1;
+		latched_raddr = top->mem_axi_araddr;
+		latched_rinsn = (top->mem_axi_arprot >> 2) & 1;
+		latched_raddr_en = 1;
+		next_fast_raddr = 1;
+	}
+
+	void handle_axi_awvalid()
+	{
+		next_awready = 1;
+		latched_waddr = top->mem_axi_awaddr;
+		latched_waddr_en = 1;
+		next_fast_waddr = 1;
+	}
+
+	void handle_axi_wvalid()
+	{
+		next_wready = 1;
+		latched_wdata = top->mem_axi_wdata;
+		latched_wstrb = top->mem_axi_wstrb;
+		latched_wdata_en = 1;
+		next_fast_wdata = 1;
+	}
+
+	void handle_axi_rvalid()
+	{
+		if (verbose)
+			printf("RD: ADDR=%08x DATA=%08x%s\n", latched_raddr,
+					latched_raddr < size() ? memory[latched_raddr >> 2] : 0, latched_rinsn ? " INSN" : "");
+		if (read_word(latched_raddr, next_rdata)) {
+			next_rvalid = 1;
+			latched_raddr_en = 0;
+		} else {
+			printf("OUT-OF-BOUNDS MEMORY READ FROM %08x\n", latched_raddr);
+			Verilated::gotFinish(true);
+		}
+	}
+
+	void handle_axi_bvalid()
+	{
+		if (verbose)
+			printf("WR: ADDR=%08x DATA=%08x STRB=%d%d%d%d\n", latched_waddr, latched_wdata,
+					(latched_wstrb >> 3) & 1, (latched_wstrb >> 2) & 1, (latched_wstrb >> 1) & 1, latched_wstrb & 1);
+		if (!write_word(latched_waddr, latched_wdata, latched_wstrb)) {
+			printf("OUT-OF-BOUNDS MEMORY WRITE TO %08x\n", latched_waddr);
+			Verilated::gotFinish(true);
+		}
+		next_bvalid = 1;
+		latched_waddr_en = 0;
+		latched_wdata_en = 0;
+	}
+
+	void begin_nba()
+	{
+		next_arready = arready;
+		next_awready = awready;
+		next_wready = wready;
+		next_bvalid = bvalid;
+		next_rvalid = rvalid;
+		next_rdata = rdata;
+		next_fast_raddr = fast_raddr;
+		next_fast_waddr = fast_waddr;
+		next_fast_wdata = fast_wdata;
+	}
+
+	void end_nba()
+	{
+		arready = next_arready;
+		awready = next_awready;
+		wready = next_wready;
+		bvalid = next_bvalid;
+		rvalid = next_rvalid;
+		rdata = next_rdata;
+		fast_raddr = next_fast_raddr;
+		fast_waddr = next_fast_waddr;
+		fast_wdata = next_fast_wdata;
+	}
+
+	// always @(negedge clk), called with the outputs of top settled after the falling edge
+	void negedge()
+	{
+		begin_nba();
+		if (top->mem_axi_arvalid && !(latched_raddr_en || fast_raddr) && (async_axi_transaction & 1)) handle_axi_arvalid();
+		if (top->mem_axi_awvalid && !(latched_waddr_en || fast_waddr) && (async_axi_transaction & 2)) handle_axi_awvalid();
+		if (top->mem_axi_wvalid  && !(latched_wdata_en || fast_wdata) && (async_axi_transaction & 4)) handle_axi_wvalid();
+		if (!rvalid && latched_raddr_en && (async_axi_transaction & 8)) handle_axi_rvalid();
+		if (!bvalid && latched_waddr_en && latched_wdata_en && (async_axi_transaction & 16)) handle_axi_bvalid();
+		end_nba();
+	}
+
+	// always @(posedge clk), called with the outputs of top as they were before the rising edge
+	void posedge()
+	{
+		begin_nba();
+		next_arready = 0;
+		next_awready = 0;
+		next_wready = 0;
+
+		next_fast_raddr = 0;
+		next_fast_waddr = 0;
+		next_fast_wdata = 0;
+
+		if (rvalid && top->mem_axi_rready)
+			next_rvalid = 0;
+
+		if (bvalid && top->mem_axi_bready)
+			next_bvalid = 0;
+
+		if (top->mem_axi_arvalid && arready && !fast_raddr) {
+			latched_raddr = top->mem_axi_araddr;
+			latched_rinsn = (top->mem_axi_arprot >> 2) & 1;
+			latched_raddr_en = 1;
+		}
+
+		if (top->mem_axi_awvalid && awready && !fast_waddr) {
+			latched_waddr = top->mem_axi_awaddr;
+			latched_waddr_en = 1;
+		}
+
+		if (top->mem_axi_wvalid && wready && !fast_wdata) {
+			latched_wdata = top->mem_axi_wdata;
+			latched_wstrb = top->mem_axi_wstrb;
+			latched_wdata_en = 1;
+		}
+
+		if (top->mem_axi_arvalid && !(latched_raddr_en || fast_raddr) && !(delay_axi_transaction & 1)) handle_axi_arvalid();
+		if (top->mem_axi_awvalid && !(latched_waddr_en || fast_waddr) && !(delay_axi_transaction & 2)) handle_axi_awvalid();
+		if (top->mem_axi_wvalid  && !(latched_wdata_en || fast_wdata) && !(delay_axi_transaction & 4)) handle_axi_wvalid();
+
+		if (!rvalid && latched_raddr_en && !(delay_axi_transaction & 8)) handle_axi_rvalid();
+		if (!bvalid && latched_waddr_en && latched_wdata_en && !(delay_axi_transaction & 16)) handle_axi_bvalid();
+		end_nba();
+
+		if (axi_test) {
+			// see page 4 of Marsaglia, George (July 2003). "Xorshift RNGs". Journal of Statistical Software 8 (14).
+			xorshift64_state ^= xorshift64_state << 13;
+			xorshift64_state ^= xorshift64_state >> 7;
+			xorshift64_state ^= xorshift64_state << 17;
+			async_axi_transaction = (xorshift64_state >> 5) & 31;
+			delay_axi_transaction = xorshift64_state & 31;
+		}
+	}
+
+	// drive the memory outputs into the model
+	void drive()
+	{
+		top->mem_axi_arready = arready;
+		top->mem_axi_awready = awready;
+		top->mem_axi_wready = wready;
+		top->mem_axi_bvalid = bvalid;
+		top->mem_axi_rvalid = rvalid;
+		top->mem_axi_rdata = rdata;
+		top->tests_passed = tests_passed;
+	}
+};
+
+// Architectural state of picorv32_core, for handing over between the ISS and
+// the RTL (+ff, +ff_to, +sample). cpuregs, reg_pc and reg_next_pc are marked
+// "verilator public" in picorv32.v, so they can be found by name.
+struct core_state
+{
+	IData *cpuregs, *reg_pc, *reg_next_pc;
+
+	bool find()
+	{
+		const VerilatedScope *scope = Verilated::threadContextp()->scopeFind("TOP.picorv32_wrapper.uut.picorv32_core");
+		VerilatedVar *var;
+		if (!scope)
+			return false;
+		if (!(var = scope->varFind("cpuregs")))
+			return false;
+		cpuregs = (IData*)var->datap();
+		if (!(var = scope->varFind("reg_pc")))
+			return false;
+		reg_pc = (IData*)var->datap();
+		if (!(var = scope->varFind("reg_next_pc")))
+			return false;
+		reg_next_pc = (IData*)var->datap();
+		return true;
+	}
+
+	// Write the ISS state into the core. Called while resetn is still low,
+	// after the last reset clock edge, so the core starts fetching at iss.pc.
+	template <class M> void load(const rv32_iss<M> &iss)
+	{
+		for (int i = 1; i < 32; i++)
+			cpuregs[i] = iss.x[i];
+		*reg_pc = iss.pc;
+		*reg_next_pc = iss.pc;
+	}
+
+	// Read the state back, called right after the clock edge that produced the
+	// trace record of a retired instruction. At that point the register write
+	// of that instruction is done and reg_pc holds the address of the next one.
+	template <class M> void store(rv32_iss<M> &iss) const
+	{
+		for (int i = 1; i < 32; i++)
+			iss.x[i] = cpuregs[i];
+		iss.pc = *reg_pc;
+	}
+};
 
 int main(int argc, char **argv, char **env)
 {
@@ -9,36 +547,471 @@ int main(int argc, char **argv, char **env)
 	Verilated::commandArgs(argc, argv);
 	Vpicorv32_wrapper* top = new Vpicorv32_wrapper;
 
-	// Tracing (vcd)
-	VerilatedVcdC* tfp = NULL;
-	const char* flag_vcd = Verilated::commandArgsPlusMatch("vcd");
-	if (flag_vcd && 0==strcmp(flag_vcd, "+vcd")) {
+	// Memory (+memsize=<bytes>, +firmware=<hexfile>, +axi_test, +axi_seed=<n>, +verbose)
+	size_t memsize = 128*1024;
+	const char* flag_memsize = Verilated::commandArgsPlusMatch("memsize=");
+	if (flag_memsize && 0==strncmp(flag_memsize, "+memsize=", 9)) {
+		memsize = strtoul(flag_memsize+9, NULL, 0);
+		if (memsize == 0 || memsize > axi4_memory::max_size) {
+			printf("+memsize must be between 1 and 0x%zx, the I/O ports start at 0x10000000.\n", axi4_memory::max_size);
+			exit(1);
+		}
+	}
+	const char* flag_axi_test = Verilated::commandArgsPlusMatch("axi_test");
+	bool axi_test = flag_axi_test && 0==strcmp(flag_axi_test, "+axi_test");
+	uint64_t axi_seed = 88172645463325252ULL;
+	const char* flag_axi_seed = Verilated::commandArgsPlusMatch("axi_seed=");
+	if (flag_axi_seed && 0==strncmp(flag_axi_seed, "+axi_seed=", 10)) {
+		axi_seed = strtoull(flag_axi_seed+10, NULL, 0);
+		if (axi_seed == 0) {
+			printf("+axi_seed must not be zero.\n");
+			exit(1);
+		}
+	}
+	const char* flag_verbose = Verilated::commandArgsPlusMatch("verbose");
+	bool verbose = flag_verbose && 0==strcmp(flag_verbose, "+verbose");
+	axi4_memory mem(top, memsize, verbose, axi_test, axi_seed);
+
+	// Checkpoints (+save=<file> together with +save_cycle=<n> or +save_pc=<addr>,
+	// +save_exit to stop after saving, +restore=<file> to continue from a checkpoint).
+	// Only available when the model is built with --savable. The checkpoint holds
+	// the model, the memory and the cycle count, waveform and trace files restart
+	// at the point of the restore.
+	const char* save_file = NULL;
+	const char* restore_file = NULL;
+	uint64_t save_cycle = 0;
+	uint32_t save_pc = 0;
+	bool save_on_cycle = false, save_on_pc = false, save_exit = plusarg_flag(argc, argv, "+save_exit");
+	const char* flag_save = Verilated::commandArgsPlusMatch("save=");
+	if (flag_save && 0==strncmp(flag_save, "+save=", 6)) {
+		save_file = flag_save+6;
+	}
+	const char* flag_save_cycle = Verilated::commandArgsPlusMatch("save_cycle=");
+	if (flag_save_cycle && 0==strncmp(flag_save_cycle, "+save_cycle=", 12)) {
+		save_cycle = strtoull(flag_save_cycle+12, NULL, 0);
+		save_on_cycle = true;
+	}
+	const char* flag_save_pc = Verilated::commandArgsPlusMatch("save_pc=");
+	if (flag_save_pc && 0==strncmp(flag_save_pc, "+save_pc=", 9)) {
+		save_pc = strtoul(flag_save_pc+9, NULL, 16);
+		save_on_pc = true;
+	}
+	if (save_file && save_on_cycle == save_on_pc) {
+		printf("+save needs exactly one of +save_cycle=<n> and +save_pc=<addr>.\n");
+		exit(1);
+	}
+	if (!save_file && (save_on_cycle || save_on_pc || save_exit)) {
+		printf("+save_cycle, +save_pc and +save_exit need +save=<file>.\n");
+		exit(1);
+	}
+	const char* flag_restore = Verilated::commandArgsPlusMatch("restore=");
+	if (flag_restore && 0==strncmp(flag_restore, "+restore=", 9)) {
+		restore_file = flag_restore+9;
+	}
+#ifndef TESTBENCH_SAVABLE
+	if (save_file || restore_file) {
+		printf("+save and +restore need a model built with --savable (see testbench_verilator in the Makefile).\n");
+		exit(1);
+	}
+#endif
+
+	// Firmware (+elf=<elffile> or +firmware=<hexfile>), not needed with +restore
+	const char* flag_elf = Verilated::commandArgsPlusMatch("elf=");
+	if (restore_file) {
+		// the memory image is part of the checkpoint
+	} else if (flag_elf && 0==strncmp(flag_elf, "+elf=", 5)) {
+		if (!mem.load_elf(flag_elf+5))
+			exit(1);
+	} else {
+		const char* firmware_file = "firmware/firmware.hex";
+		const char* flag_firmware = Verilated::commandArgsPlusMatch("firmware=");
+		if (flag_firmware && 0==strncmp(flag_firmware, "+firmware=", 10)) {
+			firmware_file = flag_firmware+10;
+		}
+		if (!mem.load_hex(firmware_file)) {
+			printf("Failed to read %s.\n", firmware_file);
+			exit(1);
+		}
+	}
+
+	// Fast-forward (+ff=<n> runs the first n instructions on the ISS in
+	// testbench_iss.h, +ff_to=<addr|symbol> runs up to that address, symbols need
+	// +elf). Then the register file and PC are loaded into the core and the RTL
+	// takes over. The ISS also stops at the first instruction it does not handle
+	// (CSRs, ECALL/EBREAK, the PicoRV32 IRQ instructions, I/O reads).
+	// Sampling (+sample=<period>,<warmup>,<detail>) alternates between the ISS
+	// for <period> instructions and the RTL for <warmup> + <detail> instructions,
+	// and estimates the CPI of the whole program from the detail windows.
+	uint64_t ff_insns = 0, sample_period = 0, sample_warmup = 0, sample_detail = 0;
+	uint32_t ff_pc = 0;
+	bool ff_on_pc = false;
+	const char* flag_ff = Verilated::commandArgsPlusMatch("ff=");
+	if (flag_ff && 0==strncmp(flag_ff, "+ff=", 4)) {
+		ff_insns = strtoull(flag_ff+4, NULL, 0);
+	}
+	const char* flag_ff_to = Verilated::commandArgsPlusMatch("ff_to=");
+	if (flag_ff_to && 0==strncmp(flag_ff_to, "+ff_to=", 7)) {
+		char *end;
+		ff_pc = strtoul(flag_ff_to+7, &end, 16);
+		if (*end || end == flag_ff_to+7) {
+			elf_file elf;
+			if (!(flag_elf && 0==strncmp(flag_elf, "+elf=", 5) && elf.open(flag_elf+5) && elf.lookup(flag_ff_to+7, ff_pc))) {
+				printf("Symbol %s not found, +ff_to=<symbol> needs +elf=<elffile>.\n", flag_ff_to+7);
+				exit(1);
+			}
+		}
+		ff_on_pc = true;
+	}
+	const char* flag_sample = Verilated::commandArgsPlusMatch("sample=");
+	if (flag_sample && 0==strncmp(flag_sample, "+sample=", 8)) {
+		unsigned long long period, warmup, detail;
+		if (sscanf(flag_sample+8, "%llu,%llu,%llu", &period, &warmup, &detail) != 3 || detail == 0) {
+			printf("Usage: +sample=<period>,<warmup>,<detail> (instruction counts, detail > 0).\n");
+			exit(1);
+		}
+		sample_period = period;
+		sample_warmup = warmup;
+		sample_detail = detail;
+	}
+	bool iss_enabled = ff_insns || ff_on_pc || sample_detail;
+	rv32_iss<axi4_memory> iss(mem, 0);
+	core_state core;
+	if (iss_enabled && restore_file) {
+		printf("+ff, +ff_to and +sample can not be combined with +restore.\n");
+		exit(1);
+	}
+	if (iss_enabled && !core.find()) {
+		printf("Failed to find the core registers (cpuregs, reg_pc, reg_next_pc) in the model.\n");
+		exit(1);
+	}
+	double iss_time = 0;
+	auto fast_forward = [&](uint64_t n, bool on_pc) {
+		double start = wall_time();
+		for (uint64_t i = 0; !mem.tohost_value && (on_pc ? iss.pc != ff_pc : i < n); i++)
+			if (!iss.step())
+				break;
+		iss_time += wall_time() - start;
+	};
+	bool iss_handoff = false;
+	if (iss_enabled) {
+		fast_forward(ff_insns, ff_on_pc);
+		iss_handoff = true;
+		printf("ISS: handing over to the RTL at %08x after %llu instructions.\n",
+				iss.pc, (unsigned long long)iss.insns);
+	}
+	uint64_t window_insns = 0, window_start = 0;
+	uint64_t samples = 0, sample_cycles = 0, sample_insns = 0, rtl_insns = 0;
+
+	// Cycle profile (+profile=<file>, see testbench_profile.h). Needs +elf=<elffile>
+	// for the symbols, also together with +restore. Only cycles simulated on the
+	// RTL are counted.
+	cycle_profile *profile = NULL;
+	const char* flag_profile = Verilated::commandArgsPlusMatch("profile=");
+	if (flag_profile && 0==strncmp(flag_profile, "+profile=", 9)) {
+		profile = new cycle_profile;
+		if (!(flag_elf && 0==strncmp(flag_elf, "+elf=", 5))) {
+			printf("+profile=<file> needs +elf=<elffile>.\n");
+			exit(1);
+		}
+		if (!profile->open(flag_elf+5))
+			exit(1);
+		if (!profile->find()) {
+			printf("Failed to find the profiled signals (cpu_state, reg_pc, dbg_mem_valid, dbg_mem_ready, dbg_pcpi_valid) in the model.\n");
+			exit(1);
+		}
+	}
+
+	// gprof profile from the trace port (+gmon=<file>, see testbench_gmon.h).
+	gmon_profile *gmon = NULL;
+	const char* flag_gmon = Verilated::commandArgsPlusMatch("gmon=");
+	if (flag_gmon && 0==strncmp(flag_gmon, "+gmon=", 6)) {
+		gmon = new gmon_profile;
+		const char* flag_progaddr_irq = Verilated::commandArgsPlusMatch("progaddr_irq=");
+		if (flag_progaddr_irq && 0==strncmp(flag_progaddr_irq, "+progaddr_irq=", 14))
+			gmon->progaddr_irq = strtoul(flag_progaddr_irq+14, NULL, 16);
+		if (!restore_file)
+			gmon->restart(0, 0);
+	}
+
+	// Tracing (vcd, or fst when built with --trace-fst)
+	// The dump can be limited to a window of clock cycles (counted from reset,
+	// like the TRAP message) with +vcd_start=<n> and +vcd_stop=<n>. +vcd_on_pc=<addr>
+	// delays the start until the decoder reaches that instruction address, and
+	// +vcd_cycles=<n> ends the dump n cycles after it started. +vcd_ring=<n> only
+	// keeps the last n to 2n cycles before the simulation ends (VCD only).
+	// Each of these options implies +vcd.
+	uint64_t vcd_start = 0, vcd_stop = 0, vcd_cycles = 0, vcd_ring = 0;
+	uint32_t vcd_on_pc = 0;
+	bool vcd = plusarg_flag(argc, argv, "+vcd"), vcd_trigger = false;
+	const char* flag_vcd_start = Verilated::commandArgsPlusMatch("vcd_start=");
+	if (flag_vcd_start && 0==strncmp(flag_vcd_start, "+vcd_start=", 11)) {
+		vcd_start = strtoull(flag_vcd_start+11, NULL, 0);
+		vcd = true;
+	}
+	const char* flag_vcd_stop = Verilated::commandArgsPlusMatch("vcd_stop=");
+	if (flag_vcd_stop && 0==strncmp(flag_vcd_stop, "+vcd_stop=", 10)) {
+		vcd_stop = strtoull(flag_vcd_stop+10, NULL, 0);
+		vcd = true;
+	}
+	const char* flag_vcd_cycles = Verilated::commandArgsPlusMatch("vcd_cycles=");
+	if (flag_vcd_cycles && 0==strncmp(flag_vcd_cycles, "+vcd_cycles=", 12)) {
+		vcd_cycles = strtoull(flag_vcd_cycles+12, NULL, 0);
+		vcd = true;
+	}
+	const char* flag_vcd_on_pc = Verilated::commandArgsPlusMatch("vcd_on_pc=");
+	if (flag_vcd_on_pc && 0==strncmp(flag_vcd_on_pc, "+vcd_on_pc=", 11)) {
+		vcd_on_pc = strtoul(flag_vcd_on_pc+11, NULL, 16);
+		vcd_trigger = true;
+		vcd = true;
+	}
+	const char* flag_vcd_ring = Verilated::commandArgsPlusMatch("vcd_ring=");
+	if (flag_vcd_ring && 0==strncmp(flag_vcd_ring, "+vcd_ring=", 10)) {
+		vcd_ring = strtoull(flag_vcd_ring+10, NULL, 0);
+		vcd = true;
+#if VM_TRACE_FST
+		printf("+vcd_ring is not supported for FST output, ignored.\n");
+		vcd_ring = 0;
+#endif
+	}
+	tracer_t* tfp = NULL;
+	bool vcd_active = false;
+	uint64_t vcd_segment = 0;
+	if (vcd) {
 		Verilated::traceEverOn(true);
-		tfp = new VerilatedVcdC;
+		tfp = new tracer_t;
 		top->trace (tfp, 99);
-		tfp->open("testbench.vcd");
+		if (vcd_ring)
+			tfp->open_ring(TRACE_FILENAME);
+		else
+			tfp->open(TRACE_FILENAME);
 	}
 
+	// The VCD writer thread only finishes the file in finish(), so every way
+	// out of main() after this point has to go through close_vcd().
+	auto close_vcd = [&tfp]() {
+		if (tfp) {
+			tfp->finish();
+			delete tfp;
+			tfp = NULL;
+		}
+	};
+
 	// Tracing (data bus, see showtrace.py)
 	FILE *trace_fd = NULL;
-	const char* flag_trace = Verilated::commandArgsPlusMatch("trace");
-	if (flag_trace && 0==strcmp(flag_trace, "+trace")) {
+	if (plusarg_flag(argc, argv, "+trace")) {
 		trace_fd = fopen("testbench.trace", "w");
 	}
 
-	top->clk = 0;
-	int t = 0;
-	while (!Verilated::gotFinish()) {
-		if (t > 200)
+	// Tracing (data bus, compressed binary format, see showtrace.cc)
+	trace_writer *trace_zst = NULL;
+	const char* flag_trace_zst = Verilated::commandArgsPlusMatch("trace_zst");
+	if (flag_trace_zst && 0==strcmp(flag_trace_zst, "+trace_zst")) {
+		trace_zst = new trace_writer;
+		if (!trace_zst->open("testbench.trace.zst")) {
+			printf("Failed to create testbench.trace.zst.\n");
+			close_vcd();
+			exit(1);
+		}
+	}
+
+	// The raw trace_data words are queued for the writer thread, which does
+	// the formatting and compression for both trace files.
+	async_writer *trace_queue = NULL;
+	if (trace_fd || trace_zst) {
+		trace_queue = new async_writer([trace_fd, trace_zst](const uint8_t *data, size_t len) {
+			const uint64_t *records = (const uint64_t*)data;
+			for (size_t i = 0; i < len / sizeof(uint64_t); i++) {
+				if (trace_fd) fprintf(trace_fd, "%9.9lx\n", (unsigned long)records[i]);
+				if (trace_zst) trace_zst->write(records[i]);
+			}
+		});
+	}
+
+	// Benchmark (simulation throughput, reported when the simulation finishes)
+	bool bench = false;
+	const char* flag_bench = Verilated::commandArgsPlusMatch("bench");
+	if (flag_bench && 0==strcmp(flag_bench, "+bench")) {
+		bench = true;
+	}
+	double bench_start = wall_time();
+	uint64_t cycles = 0, insns = 0, cycle_counter = 0;
+
+	int t = 0, reset_until = 200;
+	if (restore_file) {
+#ifdef TESTBENCH_SAVABLE
+		VerilatedRestore os;
+		os.open(restore_file);
+		if (!os.isOpen()) {
+			printf("Failed to read %s.\n", restore_file);
+			close_vcd();
+			exit(1);
+		}
+		os >> *top;
+		mem.checkpoint(os);
+		checkpoint_io(os, &t, sizeof(t));
+		checkpoint_io(os, &cycle_counter, sizeof(cycle_counter));
+		os.close();
+		printf("Restored %s at %llu clock cycles.\n", restore_file, (unsigned long long)cycle_counter);
+#endif
+	} else {
+		top->clk = 0;
+		mem.drive();
+		top->eval();
+	}
+	while (!Verilated::gotFinish() && !mem.tohost_value) {
+		if (!top->resetn && t > reset_until) {
+			if (iss_handoff) {
+				core.load(iss);
+				mem.reset_bus();
+				if (gmon)
+					gmon->restart(iss.pc, 0);
+				iss_handoff = false;
+				window_insns = 0;
+				window_start = 0;
+			}
 			top->resetn = 1;
+		}
 		top->clk = !top->clk;
+		if (top->clk) {
+			// the memory samples its inputs before the edge, its outputs change after it
+			mem.posedge();
+			top->eval();
+		} else {
+			top->eval();
+			mem.negedge();
+		}
+		mem.drive();
 		top->eval();
-		if (tfp) tfp->dump (t);
-		if (trace_fd && top->clk && top->trace_valid) fprintf(trace_fd, "%9.9lx\n", top->trace_data);
+		if (tfp && !vcd_active && cycle_counter >= vcd_start &&
+				(!vcd_trigger || (top->resetn && top->dbg_insn_addr == vcd_on_pc))) {
+			vcd_active = true;
+			if (vcd_cycles)
+				vcd_stop = cycle_counter + vcd_cycles;
+		}
+		if (vcd_active && vcd_stop && cycle_counter >= vcd_stop) {
+			// window closed, the simulation continues without tracing
+			close_vcd();
+			vcd_active = false;
+		}
+		if (vcd_active) {
+			if (vcd_ring && top->clk && ++vcd_segment == vcd_ring) {
+				tfp->next_segment();
+				vcd_segment = 0;
+			}
+			tfp->dump (t);
+		}
+		if (trace_queue && top->clk && top->trace_valid) {
+			uint64_t trace_data = top->trace_data;
+			trace_queue->put(&trace_data, sizeof(trace_data));
+		}
+		if (top->clk) {
+			cycles++;
+			cycle_counter = top->resetn ? cycle_counter + 1 : 0;
+			if (profile && top->resetn)
+				profile->sample();
+			if (gmon && top->resetn && top->trace_valid)
+				gmon->record(top->trace_data, cycle_counter, mem);
+			// every retired instruction produces exactly one trace record without the TRACE_ADDR bit
+			if (top->trace_valid && !((top->trace_data >> 33) & 1)) {
+				insns++;
+				if (iss_enabled && top->resetn) {
+					rtl_insns++;
+					window_insns++;
+					if (window_insns == sample_warmup)
+						window_start = cycle_counter;
+					if (sample_detail && window_insns == sample_warmup + sample_detail) {
+						// end of the detail window, back to the ISS and reset the core for the next handover
+						samples++;
+						sample_cycles += cycle_counter - window_start;
+						sample_insns += sample_detail;
+						core.store(iss);
+						fast_forward(sample_period, false);
+						iss_handoff = true;
+						top->resetn = 0;
+						reset_until = t + 200;
+					}
+				}
+			}
+		}
 		t += 5;
+		if (save_file && top->clk && top->resetn &&
+				(save_on_pc ? top->dbg_insn_addr == save_pc : cycle_counter == save_cycle)) {
+#ifdef TESTBENCH_SAVABLE
+			VerilatedSave os;
+			os.open(save_file);
+			if (!os.isOpen()) {
+				printf("Failed to create %s.\n", save_file);
+				close_vcd();
+				exit(1);
+			}
+			os << *top;
+			mem.checkpoint(os);
+			checkpoint_io(os, &t, sizeof(t));
+			checkpoint_io(os, &cycle_counter, sizeof(cycle_counter));
+			os.close();
+			printf("Saved %s at %llu clock cycles.\n", save_file, (unsigned long long)cycle_counter);
+#endif
+			save_file = NULL;
+			if (save_exit)
+				break;
+		}
+	}
+	close_vcd();
+	delete trace_queue;
+	if (trace_fd) fclose(trace_fd);
+	delete trace_zst;
+
+	int exit_code = 0;
+	if (mem.tohost_value) {
+		printf("TOHOST after %llu clock cycles\n", (unsigned long long)cycle_counter);
+		if (mem.tohost_value == 1) {
+			printf("ALL TESTS PASSED.\n");
+		} else {
+			printf("ERROR! tohost = 0x%08x (test %u failed)\n", mem.tohost_value, mem.tohost_value >> 1);
+			exit_code = 1;
+		}
+	}
+
+	if (iss_enabled) {
+		printf("ISS: %llu instructions in %.3f s (%.1f MIPS), RTL: %llu instructions\n",
+				(unsigned long long)iss.insns, iss_time, iss_time > 0 ? iss.insns / iss_time * 1e-6 : 0.0,
+				(unsigned long long)rtl_insns);
+		if (samples) {
+			double cpi = (double)sample_cycles / sample_insns;
+			printf("SAMPLE: %llu samples of %llu instructions, CPI %.3f, estimated %.0f clock cycles for %llu instructions\n",
+					(unsigned long long)samples, (unsigned long long)sample_detail, cpi,
+					cpi * (iss.insns + rtl_insns), (unsigned long long)(iss.insns + rtl_insns));
+		}
 	}
-	if (tfp) tfp->close();
+
+	if (profile) {
+		if (profile->write(flag_profile+9))
+			printf("PROFILE: written to %s\n", flag_profile+9);
+		else
+			printf("Failed to write %s.\n", flag_profile+9);
+		profile->print_summary();
+		delete profile;
+	}
+
+	if (gmon) {
+		if (gmon->write(flag_gmon+6))
+			printf("GMON: written to %s\n", flag_gmon+6);
+		else
+			printf("Failed to write %s.\n", flag_gmon+6);
+		gmon->print_summary();
+		delete gmon;
+	}
+
+	if (bench) {
+		double secs = wall_time() - bench_start;
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		printf("BENCH: %llu cycles, %llu instructions in %.3f s\n",
+				(unsigned long long)cycles, (unsigned long long)insns, secs);
+		printf("BENCH: %.0f cycles/s, %.0f instructions/s, peak RSS %ld KiB\n",
+				cycles / secs, insns / secs, usage.ru_maxrss);
+	}
+
 	delete top;
-	exit(0);
+	exit(exit_code);
 }
-
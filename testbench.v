@@ -71,10 +71,43 @@ module picorv32_wrapper #(
 	input clk,
 	input resetn,
 	output trap,
+`ifdef VERILATOR
+	// The memory is modelled in testbench.cc, see axi4_memory there.
+	output        mem_axi_awvalid,
+	input         mem_axi_awready,
+	output [31:0] mem_axi_awaddr,
+	output [ 2:0] mem_axi_awprot,
+
+	output        mem_axi_wvalid,
+	input         mem_axi_wready,
+	output [31:0] mem_axi_wdata,
+	output [ 3:0] mem_axi_wstrb,
+
+	input         mem_axi_bvalid,
+	output        mem_axi_bready,
+
+	output        mem_axi_arvalid,
+	input         mem_axi_arready,
+	output [31:0] mem_axi_araddr,
+	output [ 2:0] mem_axi_arprot,
+
+	input         mem_axi_rvalid,
+	output        mem_axi_rready,
+	input  [31:0] mem_axi_rdata,
+
+	input         tests_passed,
+
+	// Address of the instruction in the decoder, for +vcd_on_pc in testbench.cc.
+	output [31:0] dbg_insn_addr,
+`endif
 	output trace_valid,
 	output [35:0] trace_data
 );
+`ifndef VERILATOR
 	wire tests_passed;
+`else
+	assign dbg_insn_addr = uut.picorv32_core.dbg_insn_addr;
+`endif
 	reg [31:0] irq = 0;
 
 	reg [15:0] count_cycle = 0;
@@ -86,6 +119,7 @@ module picorv32_wrapper #(
 		irq[5] = &count_cycle[15:0];
 	end
 
+`ifndef VERILATOR
 	wire        mem_axi_awvalid;
 	wire        mem_axi_awready;
 	wire [31:0] mem_axi_awaddr;
@@ -137,6 +171,7 @@ module picorv32_wrapper #(
 
 		.tests_passed    (tests_passed    )
 	);
+`endif
 
 `ifdef RISCV_FORMAL
 	wire        rvfi_valid;
@@ -160,6 +195,10 @@ module picorv32_wrapper #(
 	wire [31:0] rvfi_mem_wdata;
 `endif
 
+`ifdef ICACHE
+	localparam integer ICACHE_LINE_WORDS = 4;
+`endif
+
 	picorv32_axi #(
 `ifndef SYNTH_TEST
 `ifdef SP_TEST
@@ -167,6 +206,47 @@ module picorv32_wrapper #(
 `endif
 `ifdef COMPRESSED_ISA
 		.COMPRESSED_ISA(1),
+`endif
+`ifdef PIPELINE
+		.ENABLE_PIPELINE(1),
+`endif
+`ifdef BRANCH_PREDICT
+		.BRANCH_PREDICT(2),
+`endif
+`ifdef EARLY_LOAD
+		.ENABLE_EARLY_LOAD(1),
+`endif
+`ifdef ICACHE
+		.ICACHE_SETS(32),
+		.ICACHE_WAYS(2),
+		.ICACHE_LINE_WORDS(ICACHE_LINE_WORDS),
+`endif
+`ifdef STORE_BUFFER
+		.STORE_BUFFER_ENTRIES(2),
+		.STORE_BUFFER_IO_ADDR(32'h 1000_0000),
+`endif
+`ifdef PERF_COUNTERS
+		.ENABLE_PERF_COUNTERS(1),
+`endif
+`ifdef IRQ_BANK
+		.ENABLE_IRQ_BANK(1),
+`endif
+`ifdef IRQ_VECTOR
+		.ENABLE_IRQ_VECTOR(1),
+`endif
+`ifdef LOG_SHIFTER
+		.LOG_SHIFTER(1),
+`endif
+`ifdef MUL_EARLY_OUT
+		.MUL_EARLY_OUT(1),
+`endif
+`ifdef FAST_MUL_FUSE
+		.ENABLE_FAST_MUL(1),
+		.FAST_MUL_FUSE(1),
+`endif
+`ifdef FAST_DIV
+		.DIV_BITS_PER_CYCLE(4),
+		.DIV_EARLY_OUT(1),
 `endif
 		.ENABLE_MUL(1),
 		.ENABLE_DIV(1),
@@ -246,12 +326,32 @@ module picorv32_wrapper #(
 	);
 `endif
 
+`ifndef VERILATOR
 	reg [1023:0] firmware_file;
 	initial begin
 		if (!$value$plusargs("firmware=%s", firmware_file))
 			firmware_file = "firmware/firmware.hex";
 		$readmemh(firmware_file, mem.memory);
 	end
+`endif
+
+`ifdef ICACHE
+	// Instruction fetches by the core and instruction words read from memory by the cache
+	integer icache_fetches, icache_words;
+	always @(posedge clk) begin
+		icache_fetches <= resetn ? icache_fetches + (uut.mem_valid && uut.mem_ready && uut.mem_instr) : 0;
+		icache_words <= resetn ? icache_words + (mem_axi_arvalid && mem_axi_arready && mem_axi_arprot[2]) : 0;
+	end
+`endif
+
+`ifdef BRANCH_PREDICT
+	// Conditional branches issued by the core and mispredicted branches reported on the trace port
+	integer bp_branches, bp_mispredicts;
+	always @(posedge clk) begin
+		bp_branches <= resetn ? bp_branches + (uut.picorv32_core.launch_next_insn && uut.picorv32_core.is_beq_bne_blt_bge_bltu_bgeu) : 0;
+		bp_mispredicts <= resetn ? bp_mispredicts + (trace_valid && trace_data[34]) : 0;
+	end
+`endif
 
 	integer cycle_counter;
 	always @(posedge clk) begin
@@ -259,6 +359,15 @@ module picorv32_wrapper #(
 		if (resetn && trap) begin
 `ifndef VERILATOR
 			repeat (10) @(posedge clk);
+`endif
+`ifdef ICACHE
+			$display("ICACHE: %1d fetches, %1d misses, hit rate %1d.%1d%%", icache_fetches, icache_words / ICACHE_LINE_WORDS,
+					(1000 - 1000 * (icache_words / ICACHE_LINE_WORDS) / icache_fetches) / 10,
+					(1000 - 1000 * (icache_words / ICACHE_LINE_WORDS) / icache_fetches) % 10);
+`endif
+`ifdef BRANCH_PREDICT
+			$display("BRANCH_PREDICT: %1d branches, %1d mispredicted, accuracy %1d.%1d%%", bp_branches, bp_mispredicts,
+					(1000 - 1000 * bp_mispredicts / bp_branches) / 10, (1000 - 1000 * bp_mispredicts / bp_branches) % 10);
 `endif
 			$display("TRAP after %1d clock cycles", cycle_counter);
 			if (tests_passed) begin
@@ -0,0 +1,196 @@
+// Minimal reader for the RV32 ELF executables used with the Verilator test benches.
+// The file is mapped read-only and PT_LOAD segments are copied directly into the
+// simulated memory, so there is no need for objcopy/makehex.py/$readmemh.
+
+#ifndef TESTBENCH_ELF_H
+#define TESTBENCH_ELF_H
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+struct elf_symbol
+{
+	uint32_t addr, size;
+	std::string name;
+};
+
+struct elf_file
+{
+	const uint8_t *data;
+	size_t size;
+
+	elf_file() : data(NULL), size(0) { }
+	~elf_file() { close(); }
+
+	const Elf32_Ehdr *ehdr() const { return (const Elf32_Ehdr*)data; }
+	const Elf32_Phdr *phdr(int i) const { return (const Elf32_Phdr*)(data + ehdr()->e_phoff + i * ehdr()->e_phentsize); }
+	const Elf32_Shdr *shdr(int i) const { return (const Elf32_Shdr*)(data + ehdr()->e_shoff + i * ehdr()->e_shentsize); }
+	uint32_t entry() const { return ehdr()->e_entry; }
+
+	bool open(const char *filename)
+	{
+		int fd = ::open(filename, O_RDONLY);
+		if (fd < 0) {
+			printf("Failed to open %s.\n", filename);
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(Elf32_Ehdr)) {
+			printf("Failed to read %s.\n", filename);
+			::close(fd);
+			return false;
+		}
+		void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			printf("Failed to mmap %s.\n", filename);
+			return false;
+		}
+		data = (const uint8_t*)p;
+		size = st.st_size;
+
+		if (memcmp(ehdr()->e_ident, ELFMAG, SELFMAG) || ehdr()->e_ident[EI_CLASS] != ELFCLASS32 ||
+				ehdr()->e_ident[EI_DATA] != ELFDATA2LSB || ehdr()->e_machine != EM_RISCV) {
+			printf("%s is not a little-endian RV32 ELF file.\n", filename);
+			close();
+			return false;
+		}
+		if (ehdr()->e_phoff + (size_t)ehdr()->e_phnum * ehdr()->e_phentsize > size ||
+				ehdr()->e_shoff + (size_t)ehdr()->e_shnum * ehdr()->e_shentsize > size) {
+			printf("%s is truncated.\n", filename);
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		if (data != NULL)
+			munmap((void*)data, size);
+		data = NULL;
+		size = 0;
+	}
+
+	// Highest byte address (exclusive) touched by a PT_LOAD segment, in 64 bits
+	// so that a segment ending at 4 GiB does not wrap around to 0.
+	uint64_t load_end() const
+	{
+		uint64_t end = 0;
+		for (int i = 0; i < ehdr()->e_phnum; i++) {
+			const Elf32_Phdr *ph = phdr(i);
+			if (ph->p_type == PT_LOAD && ph->p_memsz && (uint64_t)ph->p_paddr + ph->p_memsz > end)
+				end = (uint64_t)ph->p_paddr + ph->p_memsz;
+		}
+		return end;
+	}
+
+	// Copy all PT_LOAD segments to their physical addresses in mem[0..memsize-1].
+	bool load(uint8_t *mem, size_t memsize) const
+	{
+		for (int i = 0; i < ehdr()->e_phnum; i++) {
+			const Elf32_Phdr *ph = phdr(i);
+			if (ph->p_type != PT_LOAD || ph->p_memsz == 0)
+				continue;
+			if (ph->p_offset + (size_t)ph->p_filesz > size || ph->p_filesz > ph->p_memsz) {
+				printf("ELF segment %d is truncated.\n", i);
+				return false;
+			}
+			if ((uint64_t)ph->p_paddr + ph->p_memsz > memsize) {
+				printf("ELF segment %d (%08x..%08llx) does not fit in memory.\n", i,
+						ph->p_paddr, (unsigned long long)ph->p_paddr + ph->p_memsz - 1);
+				return false;
+			}
+			memcpy(mem + ph->p_paddr, data + ph->p_offset, ph->p_filesz);
+			memset(mem + ph->p_paddr + ph->p_filesz, 0, ph->p_memsz - ph->p_filesz);
+		}
+		return true;
+	}
+
+	// Look up a symbol in .symtab, returns false if there is no such symbol.
+	bool lookup(const char *name, uint32_t &value) const
+	{
+		for (int i = 0; i < ehdr()->e_shnum; i++) {
+			const Elf32_Shdr *sh = shdr(i);
+			if (sh->sh_type != SHT_SYMTAB || sh->sh_link >= ehdr()->e_shnum)
+				continue;
+			const Elf32_Shdr *strtab = shdr(sh->sh_link);
+			if (sh->sh_offset + (size_t)sh->sh_size > size || strtab->sh_offset + (size_t)strtab->sh_size > size)
+				continue;
+			const Elf32_Sym *syms = (const Elf32_Sym*)(data + sh->sh_offset);
+			for (size_t k = 0; k < sh->sh_size / sizeof(Elf32_Sym); k++) {
+				if (syms[k].st_name >= strtab->sh_size || syms[k].st_shndx == SHN_UNDEF)
+					continue;
+				const char *symname = (const char*)data + strtab->sh_offset + syms[k].st_name;
+				if (memchr(symname, 0, strtab->sh_size - syms[k].st_name) && !strcmp(symname, name)) {
+					value = syms[k].st_value;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Collect the functions and assembler labels in executable sections, sorted
+	// by address with one symbol per address (STT_FUNC wins over STT_NOTYPE).
+	void code_symbols(std::vector<elf_symbol> &out) const
+	{
+		std::vector<std::pair<int, elf_symbol>> syms;
+		for (int i = 0; i < ehdr()->e_shnum; i++) {
+			const Elf32_Shdr *sh = shdr(i);
+			if (sh->sh_type != SHT_SYMTAB || sh->sh_link >= ehdr()->e_shnum)
+				continue;
+			const Elf32_Shdr *strtab = shdr(sh->sh_link);
+			if (sh->sh_offset + (size_t)sh->sh_size > size || strtab->sh_offset + (size_t)strtab->sh_size > size)
+				continue;
+			const Elf32_Sym *s = (const Elf32_Sym*)(data + sh->sh_offset);
+			for (size_t k = 0; k < sh->sh_size / sizeof(Elf32_Sym); k++) {
+				int type = ELF32_ST_TYPE(s[k].st_info);
+				if ((type != STT_FUNC && type != STT_NOTYPE) || s[k].st_name == 0 || s[k].st_name >= strtab->sh_size ||
+						s[k].st_shndx == SHN_UNDEF || s[k].st_shndx >= ehdr()->e_shnum ||
+						!(shdr(s[k].st_shndx)->sh_flags & SHF_EXECINSTR))
+					continue;
+				const char *symname = (const char*)data + strtab->sh_offset + s[k].st_name;
+				if (!memchr(symname, 0, strtab->sh_size - s[k].st_name) || symname[0] == '$' || !strncmp(symname, ".L", 2))
+					continue;
+				syms.push_back({type == STT_FUNC ? 0 : 1, {s[k].st_value, s[k].st_size, symname}});
+			}
+		}
+		std::stable_sort(syms.begin(), syms.end(), [](const std::pair<int, elf_symbol> &a, const std::pair<int, elf_symbol> &b) {
+			return a.second.addr != b.second.addr ? a.second.addr < b.second.addr : a.first < b.first;
+		});
+		out.clear();
+		for (auto &sym : syms)
+			if (out.empty() || out.back().addr != sym.second.addr)
+				out.push_back(sym.second);
+	}
+};
+
+// Index of the symbol containing addr in a table from code_symbols(), or -1.
+// Symbols without a size (assembler labels) extend up to the next symbol.
+static inline int elf_symbol_find(const std::vector<elf_symbol> &syms, uint32_t addr)
+{
+	auto it = std::upper_bound(syms.begin(), syms.end(), addr,
+			[](uint32_t a, const elf_symbol &sym) { return a < sym.addr; });
+	if (it == syms.begin())
+		return -1;
+	--it;
+	if (it->size && addr - it->addr >= it->size)
+		return -1;
+	return it - syms.begin();
+}
+
+#endif
@@ -0,0 +1,229 @@
+// gprof profile from the trace port of the Verilator test bench (+gmon=<file>).
+//
+// The PC of every retired instruction is reconstructed from the trace_data
+// records the same way as in showtrace: sequential execution unless the record
+// is a TRACE_BRANCH, the first TRACE_IRQ record is the instruction at
+// progaddr_irq (+progaddr_irq=<addr> in the test bench), and the instruction
+// length comes from the program in memory. Cores with ENABLE_IRQ_VECTOR write a
+// TRACE_IRQ|TRACE_BRANCH|TRACE_ADDR record with the handler address when they
+// enter an IRQ, which is used instead of progaddr_irq.
+// The clock cycles since the previous retired instruction are charged to its
+// PC, so the histogram holds cycles instead of timer samples.
+//
+// The file is in the gmon.out format of GNU gprof, with a histogram record,
+// call graph arcs (jal/jalr/c.jal/c.jalr with rd = ra or t0) and the entry
+// count of every basic block (the first instruction after a taken branch or
+// an IRQ entry):
+//
+//   riscv32-unknown-elf-gprof firmware/firmware.elf gmon.out
+//   riscv32-unknown-elf-gprof -l -A -x firmware/firmware.elf gmon.out
+
+#ifndef TESTBENCH_GMON_H
+#define TESTBENCH_GMON_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+struct gmon_profile
+{
+	struct insn_stats
+	{
+		uint64_t count, cycles;
+	};
+
+	std::unordered_map<uint32_t, insn_stats> insns;
+	std::unordered_map<uint32_t, uint64_t> blocks;
+	std::unordered_map<uint64_t, uint64_t> arcs;
+	uint64_t last_cycle, lost;
+	uint32_t pc, progaddr_irq;
+	bool pc_valid, block_start, last_irq;
+
+	gmon_profile() : last_cycle(0), lost(0), pc(0), progaddr_irq(0x10), pc_valid(false), block_start(false), last_irq(false) { }
+
+	// The core (re)starts at pc, cycle_counter is the cycle count at that point.
+	void restart(uint32_t start_pc, uint64_t cycle_counter)
+	{
+		pc = start_pc;
+		pc_valid = true;
+		block_start = true;
+		last_irq = false;
+		last_cycle = cycle_counter;
+	}
+
+	// Called for every trace_data record, cycle_counter is the cycle it was produced in.
+	template <class M> void record(uint64_t trace_data, uint64_t cycle_counter, const M &mem)
+	{
+		uint32_t payload = trace_data;
+		bool irq_active = (trace_data >> 35) & 1;
+		bool is_addr = (trace_data >> 33) & 1;
+		bool is_branch = (trace_data >> 32) & 1;
+
+		if (irq_active && !last_irq) {
+			// IRQ entry record (ENABLE_IRQ_VECTOR), the payload is the handler address
+			bool entry = is_addr && is_branch;
+			pc = entry ? payload : progaddr_irq;
+			pc_valid = true;
+			block_start = true;
+			if (entry) {
+				last_irq = true;
+				return;
+			}
+		}
+		last_irq = irq_active;
+		if (is_addr)
+			return;
+
+		uint64_t cycles = cycle_counter - last_cycle;
+		last_cycle = cycle_counter;
+
+		uint32_t word;
+		if (pc_valid && mem.read_word(pc & ~3, word)) {
+			uint32_t next;
+			if (pc & 2) {
+				word >>= 16;
+				if ((word & 3) == 3 && mem.read_word((pc & ~3) + 4, next))
+					word |= next << 16;
+			}
+			insn_stats &insn = insns[pc];
+			insn.count++;
+			insn.cycles += cycles;
+			if (block_start)
+				blocks[pc]++;
+			if (is_branch && is_call(word))
+				arcs[(uint64_t)pc << 32 | (payload & ~1u)]++;
+			pc += (word & 3) == 3 ? 4 : 2;
+		} else {
+			pc_valid = false;
+			lost++;
+		}
+
+		block_start = is_branch;
+		if (is_branch) {
+			pc = payload & ~1u;
+			pc_valid = true;
+		}
+	}
+
+	// jal/jalr with rd = ra or t0, c.jal, c.jalr
+	static bool is_call(uint32_t word)
+	{
+		if ((word & 3) != 3) {
+			if ((word & 0xe003) == 0x2001)
+				return true;
+			return (word & 0xf07f) == 0x9002 && (word & 0x0f80) != 0;
+		}
+		uint32_t rd = (word >> 7) & 31;
+		return ((word & 0x7f) == 0x6f || (word & 0x707f) == 0x0067) && (rd == 1 || rd == 5);
+	}
+
+	static void put32(FILE *f, uint32_t v)
+	{
+		uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+		fwrite(b, 1, 4, f);
+	}
+
+	bool write(const char *filename) const
+	{
+		FILE *f = fopen(filename, "wb");
+		if (f == NULL)
+			return false;
+
+		// struct gmon_hdr: cookie, version 1, spare
+		fwrite("gmon", 1, 4, f);
+		put32(f, 1);
+		put32(f, 0);
+		put32(f, 0);
+		put32(f, 0);
+
+		if (!insns.empty()) {
+			uint32_t lowpc = 0xffffffff, highpc = 0;
+			uint64_t max_cycles = 0;
+			for (auto &it : insns) {
+				lowpc = std::min(lowpc, it.first);
+				highpc = std::max(highpc, it.first + 2);
+			}
+			// 2 byte bins unless that makes the histogram too large
+			uint32_t bin_size = 2;
+			while ((highpc - lowpc) / bin_size > (1 << 20))
+				bin_size *= 2;
+			lowpc &= ~(bin_size - 1);
+			highpc = (highpc + bin_size - 1) & ~(bin_size - 1);
+			std::vector<uint64_t> bins((highpc - lowpc) / bin_size);
+			for (auto &it : insns)
+				bins[(it.first - lowpc) / bin_size] += it.second.cycles;
+			for (uint64_t c : bins)
+				max_cycles = std::max(max_cycles, c);
+
+			// The bins are 16 bit, scale down by a power of 10 and report
+			// K/M/Gcycles with a matching rate if the cycles do not fit.
+			uint64_t scale = 1;
+			while (max_cycles / scale > 0xffff)
+				scale *= 10;
+			const char *dimen = "cycles";
+			uint64_t unit = 1;
+			if (scale > 1000000) {
+				dimen = "Gcycles";
+				unit = 1000000000;
+			} else if (scale > 1000) {
+				dimen = "Mcycles";
+				unit = 1000000;
+			} else if (scale > 1) {
+				dimen = "Kcycles";
+				unit = 1000;
+			}
+			char dimen_buf[15];
+			memset(dimen_buf, 0, sizeof(dimen_buf));
+			strncpy(dimen_buf, dimen, sizeof(dimen_buf));
+
+			fputc(0, f); // GMON_TAG_TIME_HIST
+			put32(f, lowpc);
+			put32(f, highpc);
+			put32(f, bins.size());
+			put32(f, unit / scale);
+			fwrite(dimen_buf, 1, sizeof(dimen_buf), f);
+			fputc('c', f);
+			for (uint64_t c : bins) {
+				uint64_t v = (c + scale / 2) / scale;
+				uint8_t b[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+				fwrite(b, 1, 2, f);
+			}
+		}
+
+		for (auto &it : arcs) {
+			fputc(1, f); // GMON_TAG_CG_ARC
+			put32(f, it.first >> 32);
+			put32(f, it.first);
+			put32(f, std::min(it.second, (uint64_t)0xffffffff));
+		}
+
+		if (!blocks.empty()) {
+			fputc(2, f); // GMON_TAG_BB_COUNT
+			put32(f, blocks.size());
+			for (auto &it : blocks) {
+				put32(f, it.first);
+				put32(f, std::min(it.second, (uint64_t)0xffffffff));
+			}
+		}
+
+		return fclose(f) == 0;
+	}
+
+	void print_summary() const
+	{
+		uint64_t count = 0, cycles = 0;
+		for (auto &it : insns) {
+			count += it.second.count;
+			cycles += it.second.cycles;
+		}
+		printf("GMON: %llu instructions at %zu addresses, %llu cycles, %zu basic blocks, %zu call arcs\n",
+				(unsigned long long)count, insns.size(), (unsigned long long)cycles, blocks.size(), arcs.size());
+		if (lost)
+			printf("GMON: %llu instructions at unknown addresses were skipped\n", (unsigned long long)lost);
+	}
+};
+
+#endif
@@ -0,0 +1,290 @@
+// RV32IMC instruction set simulator for fast-forwarding the Verilator test bench.
+//
+// Only the unprivileged user-level instructions are modelled. The ISS stops
+// (step() returns false, pc still points at the instruction) on everything
+// whose effect it can not reproduce exactly: the PicoRV32 custom instructions,
+// ECALL/EBREAK, CSR accesses (rdcycle etc.), misaligned accesses, illegal
+// instructions and failed memory accesses. The RTL then picks up from there.
+//
+// The memory class M must provide bool read_word(addr, value) and
+// bool write_word(addr, value, wstrb) for word-aligned addresses.
+
+#ifndef TESTBENCH_ISS_H
+#define TESTBENCH_ISS_H
+
+#include <stdint.h>
+
+template <class M>
+struct rv32_iss
+{
+	M &mem;
+	uint32_t x[32], pc;
+	uint64_t insns;
+
+	rv32_iss(M &mem, uint32_t pc) : mem(mem), pc(pc), insns(0)
+	{
+		for (int i = 0; i < 32; i++)
+			x[i] = 0;
+	}
+
+	static int32_t sext(uint32_t value, int bits) { return (int32_t)(value << (32 - bits)) >> (32 - bits); }
+	static uint32_t bits(uint32_t value, int hi, int lo) { return (value >> lo) & ((2u << (hi - lo)) - 1); }
+
+	bool fetch(uint32_t addr, uint32_t &insn)
+	{
+		uint32_t lo, hi;
+		if (!mem.read_word(addr & ~3, lo))
+			return false;
+		if (!(addr & 2)) {
+			insn = lo;
+			return true;
+		}
+		insn = lo >> 16;
+		if ((insn & 3) != 3)
+			return true;
+		if (!mem.read_word((addr & ~3) + 4, hi))
+			return false;
+		insn |= hi << 16;
+		return true;
+	}
+
+	// Translate a compressed instruction to its 32 bit equivalent, returns 0 if illegal.
+	static uint32_t expand(uint32_t c)
+	{
+		uint32_t rd = bits(c, 11, 7), rs2 = bits(c, 6, 2);
+		uint32_t rd_ = 8 + bits(c, 4, 2), rs1_ = 8 + bits(c, 9, 7);
+		int32_t imm;
+
+#define ITYPE(imm, rs1, f3, rd, op) ((((uint32_t)(imm) & 0xfff) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define RTYPE(f7, rs2, rs1, f3, rd, op) (((f7) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define STYPE(imm, rs2, rs1, f3) (((((uint32_t)(imm) >> 5) & 0x7f) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | (((imm) & 31) << 7) | 0x23)
+#define BTYPE(imm, rs2, rs1, f3) ((bits(imm, 12, 12) << 31) | (bits(imm, 10, 5) << 25) | ((rs2) << 20) | ((rs1) << 15) | \
+		((f3) << 12) | (bits(imm, 4, 1) << 8) | (bits(imm, 11, 11) << 7) | 0x63)
+#define JTYPE(imm, rd) ((bits(imm, 20, 20) << 31) | (bits(imm, 10, 1) << 21) | (bits(imm, 11, 11) << 20) | \
+		(bits(imm, 19, 12) << 12) | ((rd) << 7) | 0x6f)
+
+		switch ((bits(c, 15, 13) << 2) | (c & 3)) {
+		case 0x00: // C.ADDI4SPN
+			imm = (bits(c, 10, 7) << 6) | (bits(c, 12, 11) << 4) | (bits(c, 5, 5) << 3) | (bits(c, 6, 6) << 2);
+			return imm ? ITYPE(imm, 2, 0, rd_, 0x13) : 0;
+		case 0x08: // C.LW
+			imm = (bits(c, 5, 5) << 6) | (bits(c, 12, 10) << 3) | (bits(c, 6, 6) << 2);
+			return ITYPE(imm, rs1_, 2, rd_, 0x03);
+		case 0x18: // C.SW
+			imm = (bits(c, 5, 5) << 6) | (bits(c, 12, 10) << 3) | (bits(c, 6, 6) << 2);
+			return STYPE(imm, rd_, rs1_, 2);
+		case 0x01: // C.ADDI, C.NOP
+			imm = sext((bits(c, 12, 12) << 5) | rs2, 6);
+			return ITYPE(imm, rd, 0, rd, 0x13);
+		case 0x05: // C.JAL
+		case 0x15: // C.J
+			imm = sext((bits(c, 12, 12) << 11) | (bits(c, 8, 8) << 10) | (bits(c, 10, 9) << 8) | (bits(c, 6, 6) << 7) |
+					(bits(c, 7, 7) << 6) | (bits(c, 2, 2) << 5) | (bits(c, 11, 11) << 4) | (bits(c, 5, 3) << 1), 12);
+			return JTYPE((uint32_t)imm, bits(c, 15, 13) == 1 ? 1 : 0);
+		case 0x09: // C.LI
+			imm = sext((bits(c, 12, 12) << 5) | rs2, 6);
+			return ITYPE(imm, 0, 0, rd, 0x13);
+		case 0x0d: // C.ADDI16SP, C.LUI
+			if (rd == 2) {
+				imm = sext((bits(c, 12, 12) << 9) | (bits(c, 4, 3) << 7) | (bits(c, 5, 5) << 6) |
+						(bits(c, 2, 2) << 5) | (bits(c, 6, 6) << 4), 10);
+				return imm ? ITYPE(imm, 2, 0, 2, 0x13) : 0;
+			}
+			imm = sext((bits(c, 12, 12) << 17) | (rs2 << 12), 18);
+			return imm ? ((uint32_t)imm & 0xfffff000) | (rd << 7) | 0x37 : 0;
+		case 0x11: // C.SRLI, C.SRAI, C.ANDI, C.SUB, C.XOR, C.OR, C.AND
+			imm = sext((bits(c, 12, 12) << 5) | rs2, 6);
+			switch (bits(c, 11, 10)) {
+			case 0: return bits(c, 12, 12) ? 0 : ITYPE(imm & 31, rs1_, 5, rs1_, 0x13);
+			case 1: return bits(c, 12, 12) ? 0 : ITYPE((imm & 31) | 0x400, rs1_, 5, rs1_, 0x13);
+			case 2: return ITYPE(imm, rs1_, 7, rs1_, 0x13);
+			default:
+				if (bits(c, 12, 12))
+					return 0;
+				switch (bits(c, 6, 5)) {
+				case 0: return RTYPE(0x20, rd_, rs1_, 0, rs1_, 0x33);
+				case 1: return RTYPE(0, rd_, rs1_, 4, rs1_, 0x33);
+				case 2: return RTYPE(0, rd_, rs1_, 6, rs1_, 0x33);
+				default: return RTYPE(0, rd_, rs1_, 7, rs1_, 0x33);
+				}
+			}
+		case 0x19: // C.BEQZ
+		case 0x1d: // C.BNEZ
+			imm = sext((bits(c, 12, 12) << 8) | (bits(c, 6, 5) << 6) | (bits(c, 2, 2) << 5) |
+					(bits(c, 11, 10) << 3) | (bits(c, 4, 3) << 1), 9);
+			return BTYPE((uint32_t)imm, 0, rs1_, bits(c, 13, 13));
+		case 0x02: // C.SLLI
+			return bits(c, 12, 12) ? 0 : ITYPE(rs2, rd, 1, rd, 0x13);
+		case 0x0a: // C.LWSP
+			imm = (bits(c, 3, 2) << 6) | (bits(c, 12, 12) << 5) | (bits(c, 6, 4) << 2);
+			return rd ? ITYPE(imm, 2, 2, rd, 0x03) : 0;
+		case 0x12: // C.JR, C.MV, C.EBREAK, C.JALR, C.ADD
+			if (!bits(c, 12, 12)) {
+				if (!rs2)
+					return rd ? ITYPE(0, rd, 0, 0, 0x67) : 0;
+				return RTYPE(0, rs2, 0, 0, rd, 0x33);
+			}
+			if (!rs2)
+				return rd ? ITYPE(0, rd, 0, 1, 0x67) : 0x00100073;
+			return RTYPE(0, rs2, rd, 0, rd, 0x33);
+		case 0x1a: // C.SWSP
+			imm = (bits(c, 8, 7) << 6) | (bits(c, 12, 9) << 2);
+			return STYPE(imm, rs2, 2, 2);
+		}
+		return 0;
+
+#undef ITYPE
+#undef RTYPE
+#undef STYPE
+#undef BTYPE
+#undef JTYPE
+	}
+
+	bool load(uint32_t addr, int size, bool is_signed, uint32_t &value)
+	{
+		uint32_t word;
+		if ((addr & (size - 1)) || !mem.read_word(addr & ~3, word))
+			return false;
+		value = word >> (8 * (addr & 3));
+		if (size < 4)
+			value = is_signed ? sext(value, 8 * size) : value & ((1u << (8 * size)) - 1);
+		return true;
+	}
+
+	bool store(uint32_t addr, int size, uint32_t value)
+	{
+		if (addr & (size - 1))
+			return false;
+		int shift = 8 * (addr & 3);
+		return mem.write_word(addr & ~3, value << shift, ((1u << size) - 1) << (addr & 3));
+	}
+
+	// Execute one instruction, returns false (without side effects) if the ISS can not execute it.
+	bool step()
+	{
+		uint32_t insn;
+		if (!fetch(pc, insn))
+			return false;
+		uint32_t len = (insn & 3) == 3 ? 4 : 2;
+		if (len == 2 && (insn = expand(insn & 0xffff)) == 0)
+			return false;
+
+		uint32_t opcode = insn & 0x7f, rd = bits(insn, 11, 7), funct3 = bits(insn, 14, 12);
+		uint32_t rs1 = x[bits(insn, 19, 15)], rs2 = x[bits(insn, 24, 20)];
+		int32_t imm_i = sext(insn >> 20, 12);
+		int32_t imm_s = sext((bits(insn, 31, 25) << 5) | bits(insn, 11, 7), 12);
+		int32_t imm_b = sext((bits(insn, 31, 31) << 12) | (bits(insn, 7, 7) << 11) | (bits(insn, 30, 25) << 5) | (bits(insn, 11, 8) << 1), 13);
+		int32_t imm_j = sext((bits(insn, 31, 31) << 20) | (bits(insn, 19, 12) << 12) | (bits(insn, 20, 20) << 11) | (bits(insn, 30, 21) << 1), 21);
+		uint32_t next_pc = pc + len, result = 0;
+		bool write_rd = true;
+
+		switch (opcode) {
+		case 0x37: // LUI
+			result = insn & 0xfffff000;
+			break;
+		case 0x17: // AUIPC
+			result = pc + (insn & 0xfffff000);
+			break;
+		case 0x6f: // JAL
+			result = next_pc;
+			next_pc = pc + imm_j;
+			break;
+		case 0x67: // JALR
+			if (funct3 != 0)
+				return false;
+			result = next_pc;
+			next_pc = (rs1 + imm_i) & ~1;
+			break;
+		case 0x63: { // BRANCH
+			bool taken;
+			switch (funct3) {
+			case 0: taken = rs1 == rs2; break;
+			case 1: taken = rs1 != rs2; break;
+			case 4: taken = (int32_t)rs1 < (int32_t)rs2; break;
+			case 5: taken = (int32_t)rs1 >= (int32_t)rs2; break;
+			case 6: taken = rs1 < rs2; break;
+			case 7: taken = rs1 >= rs2; break;
+			default: return false;
+			}
+			if (taken)
+				next_pc = pc + imm_b;
+			write_rd = false;
+			break;
+		}
+		case 0x03: // LOAD
+			switch (funct3) {
+			case 0: if (!load(rs1 + imm_i, 1, true, result)) return false; break;
+			case 1: if (!load(rs1 + imm_i, 2, true, result)) return false; break;
+			case 2: if (!load(rs1 + imm_i, 4, false, result)) return false; break;
+			case 4: if (!load(rs1 + imm_i, 1, false, result)) return false; break;
+			case 5: if (!load(rs1 + imm_i, 2, false, result)) return false; break;
+			default: return false;
+			}
+			break;
+		case 0x23: // STORE
+			if (funct3 > 2 || !store(rs1 + imm_s, 1 << funct3, rs2))
+				return false;
+			write_rd = false;
+			break;
+		case 0x13: // OP-IMM
+			switch (funct3) {
+			case 0: result = rs1 + imm_i; break;
+			case 1: if (bits(insn, 31, 25)) return false; result = rs1 << bits(insn, 24, 20); break;
+			case 2: result = (int32_t)rs1 < imm_i; break;
+			case 3: result = rs1 < (uint32_t)imm_i; break;
+			case 4: result = rs1 ^ imm_i; break;
+			case 5:
+				if (bits(insn, 31, 25) == 0)
+					result = rs1 >> bits(insn, 24, 20);
+				else if (bits(insn, 31, 25) == 0x20)
+					result = (int32_t)rs1 >> bits(insn, 24, 20);
+				else
+					return false;
+				break;
+			case 6: result = rs1 | imm_i; break;
+			case 7: result = rs1 & imm_i; break;
+			}
+			break;
+		case 0x33: // OP
+			switch ((bits(insn, 31, 25) << 3) | funct3) {
+			case 0x000: result = rs1 + rs2; break;
+			case 0x100: result = rs1 - rs2; break;
+			case 0x001: result = rs1 << (rs2 & 31); break;
+			case 0x002: result = (int32_t)rs1 < (int32_t)rs2; break;
+			case 0x003: result = rs1 < rs2; break;
+			case 0x004: result = rs1 ^ rs2; break;
+			case 0x005: result = rs1 >> (rs2 & 31); break;
+			case 0x105: result = (int32_t)rs1 >> (rs2 & 31); break;
+			case 0x006: result = rs1 | rs2; break;
+			case 0x007: result = rs1 & rs2; break;
+			case 0x008: result = rs1 * rs2; break;
+			case 0x009: result = ((int64_t)(int32_t)rs1 * (int64_t)(int32_t)rs2) >> 32; break;
+			case 0x00a: result = ((int64_t)(int32_t)rs1 * (uint64_t)rs2) >> 32; break;
+			case 0x00b: result = ((uint64_t)rs1 * (uint64_t)rs2) >> 32; break;
+			case 0x00c:
+				result = rs2 == 0 ? ~0u : (rs1 == 0x80000000 && rs2 == ~0u) ? rs1 : (uint32_t)((int32_t)rs1 / (int32_t)rs2);
+				break;
+			case 0x00d: result = rs2 == 0 ? ~0u : rs1 / rs2; break;
+			case 0x00e:
+				result = rs2 == 0 ? rs1 : (rs1 == 0x80000000 && rs2 == ~0u) ? 0 : (uint32_t)((int32_t)rs1 % (int32_t)rs2);
+				break;
+			case 0x00f: result = rs2 == 0 ? rs1 : rs1 % rs2; break;
+			default: return false;
+			}
+			break;
+		case 0x0f: // FENCE, FENCE.I
+			write_rd = false;
+			break;
+		default: // SYSTEM, custom-0 (PicoRV32 IRQ instructions), illegal
+			return false;
+		}
+
+		if (write_rd && rd)
+			x[rd] = result;
+		pc = next_pc;
+		insns++;
+		return true;
+	}
+};
+
+#endif
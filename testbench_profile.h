@@ -0,0 +1,235 @@
+// Cycle accounting profile for the Verilator test bench (+profile=<file>).
+//
+// Every clock cycle after reset is charged to the function containing reg_pc
+// and to one of the categories below, decided by cpu_state and the memory and
+// PCPI handshakes (cpu_state, reg_pc, dbg_mem_valid, dbg_mem_ready and
+// dbg_pcpi_valid are marked "verilator public" in picorv32.v). The call stack
+// is reconstructed from the PC alone: entering a function at its first address
+// is a call, reaching a function further down the stack is a return (this also
+// covers retirq), anything else replaces the innermost frame.
+//
+// The result is written in the folded stack format of flamegraph.pl, with the
+// category as the innermost frame, one line per stack:
+//
+//   main;stats;fetch_wait 1234
+
+#ifndef TESTBENCH_PROFILE_H
+#define TESTBENCH_PROFILE_H
+
+#include "testbench_elf.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct cycle_profile
+{
+	enum {
+		CAT_FETCH_WAIT,	// cpu_state_fetch, instruction fetch not done yet
+		CAT_FETCH,	// cpu_state_fetch, decode and dispatch
+		CAT_EXEC,	// cpu_state_ld_rs1, cpu_state_ld_rs2, cpu_state_exec
+		CAT_PCPI,	// waiting for a PCPI core (mul/div)
+		CAT_SHIFT,	// cpu_state_shift
+		CAT_LDMEM,	// cpu_state_ldmem
+		CAT_STMEM,	// cpu_state_stmem
+		CAT_TRAP,	// cpu_state_trap
+		CAT_NUM
+	};
+
+	static const char *cat_name(int cat)
+	{
+		static const char *const names[CAT_NUM] = {
+			"fetch_wait", "fetch", "exec", "pcpi", "shift", "ldmem", "stmem", "trap"
+		};
+		return names[cat];
+	}
+
+	struct node
+	{
+		int parent, func;
+		uint64_t cycles[CAT_NUM];
+	};
+
+	static const int max_depth = 128;
+
+	std::vector<elf_symbol> syms;
+	std::vector<node> nodes;
+	std::unordered_map<uint64_t, int> children;
+	std::vector<int> stack;
+	uint32_t func_start, func_end;
+	int func;
+
+	CData *cpu_state, *mem_valid, *mem_ready, *pcpi_valid;
+	IData *reg_pc;
+
+	cycle_profile() : func_start(0), func_end(0), func(-1) { }
+
+	// Read the symbol table and find the sampled signals in the model.
+	bool open(const char *elf_filename)
+	{
+		elf_file elf;
+		if (!elf.open(elf_filename))
+			return false;
+		elf.code_symbols(syms);
+		if (syms.empty()) {
+			printf("%s has no symbols.\n", elf_filename);
+			return false;
+		}
+		return true;
+	}
+
+	bool find()
+	{
+		const VerilatedScope *scope = Verilated::threadContextp()->scopeFind("TOP.picorv32_wrapper.uut.picorv32_core");
+		VerilatedVar *var;
+		if (!scope)
+			return false;
+		if (!(var = scope->varFind("cpu_state")))
+			return false;
+		cpu_state = (CData*)var->datap();
+		if (!(var = scope->varFind("dbg_mem_valid")))
+			return false;
+		mem_valid = (CData*)var->datap();
+		if (!(var = scope->varFind("dbg_mem_ready")))
+			return false;
+		mem_ready = (CData*)var->datap();
+		if (!(var = scope->varFind("dbg_pcpi_valid")))
+			return false;
+		pcpi_valid = (CData*)var->datap();
+		if (!(var = scope->varFind("reg_pc")))
+			return false;
+		reg_pc = (IData*)var->datap();
+		return true;
+	}
+
+	int child(int parent, int f)
+	{
+		uint64_t key = (uint64_t)(uint32_t)parent << 32 | (uint32_t)f;
+		auto it = children.find(key);
+		if (it != children.end())
+			return it->second;
+		node n = { parent, f, { } };
+		nodes.push_back(n);
+		children[key] = nodes.size() - 1;
+		return nodes.size() - 1;
+	}
+
+	// Called after every rising clock edge while the core is out of reset.
+	void sample()
+	{
+		uint32_t pc = *reg_pc;
+		if (pc - func_start >= func_end - func_start)
+			enter(pc);
+
+		int cat;
+		switch (*cpu_state) {
+		case 0x80: cat = CAT_TRAP; break;
+		case 0x40: cat = *mem_valid && !*mem_ready ? CAT_FETCH_WAIT : CAT_FETCH; break;
+		case 0x04: cat = CAT_SHIFT; break;
+		case 0x02: cat = CAT_STMEM; break;
+		case 0x01: cat = CAT_LDMEM; break;
+		default: cat = *pcpi_valid ? CAT_PCPI : CAT_EXEC; break;
+		}
+		nodes[stack.back()].cycles[cat]++;
+	}
+
+	// The PC left the current function, update the call stack.
+	void enter(uint32_t pc)
+	{
+		int f = elf_symbol_find(syms, pc);
+		if (f < 0) {
+			// outside of all symbols, look up again at the next PC
+			func_start = pc;
+			func_end = pc + 1;
+			f = syms.size();
+		} else {
+			func_start = syms[f].addr;
+			func_end = f + 1 < (int)syms.size() ? syms[f + 1].addr : 0;
+			if (syms[f].size && (func_end == 0 || func_start + syms[f].size < func_end))
+				func_end = func_start + syms[f].size;
+		}
+		if (f == func && !stack.empty())
+			return;
+		func = f;
+
+		if (stack.empty()) {
+			stack.push_back(child(-1, f));
+			return;
+		}
+		if (f < (int)syms.size() && pc == syms[f].addr && (int)stack.size() < max_depth) {
+			stack.push_back(child(stack.back(), f));
+			return;
+		}
+		for (int i = stack.size() - 2; i >= 0; i--) {
+			if (nodes[stack[i]].func == f) {
+				stack.resize(i + 1);
+				return;
+			}
+		}
+		stack.back() = child(stack.size() > 1 ? stack[stack.size() - 2] : -1, f);
+	}
+
+	std::string frames(int n) const
+	{
+		std::string s;
+		if (nodes[n].parent >= 0)
+			s = frames(nodes[n].parent) + ";";
+		if (nodes[n].func < (int)syms.size())
+			s += syms[nodes[n].func].name;
+		else
+			s += "[unknown]";
+		return s;
+	}
+
+	bool write(const char *filename) const
+	{
+		FILE *f = fopen(filename, "w");
+		if (f == NULL)
+			return false;
+		for (size_t n = 0; n < nodes.size(); n++) {
+			std::string s = frames(n);
+			for (int cat = 0; cat < CAT_NUM; cat++)
+				if (nodes[n].cycles[cat])
+					fprintf(f, "%s;%s %llu\n", s.c_str(), cat_name(cat), (unsigned long long)nodes[n].cycles[cat]);
+		}
+		return fclose(f) == 0;
+	}
+
+	// Print the self cycles of the most expensive functions, per category.
+	void print_summary(int max_funcs = 15) const
+	{
+		std::vector<std::vector<uint64_t>> funcs(syms.size() + 1, std::vector<uint64_t>(CAT_NUM + 1));
+		uint64_t total = 0;
+		for (auto &n : nodes) {
+			for (int cat = 0; cat < CAT_NUM; cat++) {
+				funcs[n.func][cat] += n.cycles[cat];
+				funcs[n.func][CAT_NUM] += n.cycles[cat];
+				total += n.cycles[cat];
+			}
+		}
+		std::vector<int> order;
+		for (size_t i = 0; i < funcs.size(); i++)
+			if (funcs[i][CAT_NUM])
+				order.push_back(i);
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return funcs[a][CAT_NUM] > funcs[b][CAT_NUM]; });
+		if ((int)order.size() > max_funcs)
+			order.resize(max_funcs);
+
+		printf("PROFILE: %llu cycles\n", (unsigned long long)total);
+		printf("PROFILE: %10s %6s", "cycles", "%");
+		for (int cat = 0; cat < CAT_NUM; cat++)
+			printf(" %10s", cat_name(cat));
+		printf("  function\n");
+		for (int i : order) {
+			printf("PROFILE: %10llu %6.2f", (unsigned long long)funcs[i][CAT_NUM], 100.0 * funcs[i][CAT_NUM] / total);
+			for (int cat = 0; cat < CAT_NUM; cat++)
+				printf(" %10llu", (unsigned long long)funcs[i][cat]);
+			printf("  %s\n", i < (int)syms.size() ? syms[i].name.c_str() : "[unknown]");
+		}
+	}
+};
+
+#endif
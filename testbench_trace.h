@@ -0,0 +1,292 @@
+// Compact binary format for the trace_valid/trace_data port (see ENABLE_TRACE).
+//
+// The file is a zstd stream. Decompressed, it starts with the 8 byte magic
+// "PICOTRC1", followed by one record per trace_data word:
+//
+//   tag byte:  bits [3:0] = trace_data[35:32] (TRACE_IRQ, TRACE_MISPREDICT, TRACE_ADDR, TRACE_BRANCH)
+//              bits [7:4] = payload if < 15, otherwise 15 and a LEB128 payload follows
+//
+// The payload is the zigzag encoded difference to the previous branch target
+// for TRACE_BRANCH records, to the previous address for TRACE_ADDR records,
+// and the plain 32 bit value for data records.
+//
+// trace_reader also accepts the uncompressed binary stream and the text
+// format ("%9.9lx" per line) written by the test benches with +trace.
+
+#ifndef TESTBENCH_TRACE_H
+#define TESTBENCH_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <zstd.h>
+
+#define TRACE_MAGIC "PICOTRC1"
+
+struct trace_codec
+{
+	uint32_t last_branch, last_addr;
+
+	trace_codec() : last_branch(0), last_addr(0) { }
+
+	// Encode one record into buf (at most 6 bytes), returns the number of bytes used.
+	int encode(uint64_t trace_data, uint8_t *buf)
+	{
+		uint8_t flags = (trace_data >> 32) & 15;
+		uint32_t payload = trace_data;
+		if (flags & 1) {
+			uint32_t delta = payload - last_branch;
+			last_branch = payload;
+			payload = (delta << 1) ^ -(delta >> 31);
+		} else if (flags & 2) {
+			uint32_t delta = payload - last_addr;
+			last_addr = payload;
+			payload = (delta << 1) ^ -(delta >> 31);
+		}
+		if (payload < 15) {
+			buf[0] = flags | (payload << 4);
+			return 1;
+		}
+		int n = 0;
+		buf[n++] = flags | 0xf0;
+		while (payload >= 0x80) {
+			buf[n++] = payload | 0x80;
+			payload >>= 7;
+		}
+		buf[n++] = payload;
+		return n;
+	}
+
+	// Decode one record from buf[0..len-1], returns the number of bytes consumed or 0 if incomplete.
+	int decode(const uint8_t *buf, size_t len, uint64_t &trace_data)
+	{
+		if (len == 0)
+			return 0;
+		uint8_t flags = buf[0] & 15;
+		uint32_t payload = buf[0] >> 4;
+		size_t n = 1;
+		if (payload == 15) {
+			payload = 0;
+			for (int shift = 0;; shift += 7) {
+				if (n == len || shift > 28)
+					return 0;
+				payload |= (uint32_t)(buf[n] & 0x7f) << shift;
+				if (!(buf[n++] & 0x80))
+					break;
+			}
+		}
+		if (flags & 1) {
+			payload = last_branch + ((payload >> 1) ^ -(payload & 1));
+			last_branch = payload;
+		} else if (flags & 2) {
+			payload = last_addr + ((payload >> 1) ^ -(payload & 1));
+			last_addr = payload;
+		}
+		trace_data = (uint64_t)flags << 32 | payload;
+		return n;
+	}
+};
+
+struct trace_writer
+{
+	FILE *f;
+	ZSTD_CCtx *cctx;
+	trace_codec codec;
+	std::vector<uint8_t> inbuf, outbuf;
+	size_t inpos;
+
+	trace_writer() : f(NULL), cctx(NULL), inpos(0) { }
+	~trace_writer() { close(); }
+
+	bool open(const char *filename, int level = 3)
+	{
+		f = fopen(filename, "wb");
+		if (f == NULL)
+			return false;
+		cctx = ZSTD_createCCtx();
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+		inbuf.resize(ZSTD_CStreamInSize());
+		outbuf.resize(ZSTD_CStreamOutSize());
+		memcpy(inbuf.data(), TRACE_MAGIC, 8);
+		inpos = 8;
+		return true;
+	}
+
+	void compress(ZSTD_EndDirective mode)
+	{
+		ZSTD_inBuffer in = { inbuf.data(), inpos, 0 };
+		bool done;
+		do {
+			ZSTD_outBuffer out = { outbuf.data(), outbuf.size(), 0 };
+			size_t remaining = ZSTD_compressStream2(cctx, &out, &in, mode);
+			if (ZSTD_isError(remaining)) {
+				fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(remaining));
+				break;
+			}
+			fwrite(outbuf.data(), 1, out.pos, f);
+			done = mode == ZSTD_e_end ? remaining == 0 : in.pos == in.size;
+		} while (!done);
+		inpos = 0;
+	}
+
+	void write(uint64_t trace_data)
+	{
+		if (inpos + 8 > inbuf.size())
+			compress(ZSTD_e_continue);
+		inpos += codec.encode(trace_data, inbuf.data() + inpos);
+	}
+
+	void close()
+	{
+		if (f == NULL)
+			return;
+		compress(ZSTD_e_end);
+		ZSTD_freeCCtx(cctx);
+		fclose(f);
+		f = NULL;
+		cctx = NULL;
+	}
+};
+
+struct trace_reader
+{
+	enum { FMT_ZSTD, FMT_BINARY, FMT_TEXT } format;
+	FILE *f;
+	ZSTD_DCtx *dctx;
+	trace_codec codec;
+	std::vector<uint8_t> inbuf, buf;
+	ZSTD_inBuffer in;
+	size_t pos, len, zstd_ret;
+	bool in_eof, eof;
+
+	trace_reader() : f(NULL), dctx(NULL), pos(0), len(0), zstd_ret(0), in_eof(false), eof(false) { }
+	~trace_reader() { close(); }
+
+	bool open(const char *filename)
+	{
+		f = strcmp(filename, "-") ? fopen(filename, "rb") : stdin;
+		if (f == NULL)
+			return false;
+		inbuf.resize(ZSTD_DStreamInSize());
+		buf.resize(std::max(ZSTD_DStreamInSize(), ZSTD_DStreamOutSize()) + 16);
+		in.src = inbuf.data();
+		in.size = fread(inbuf.data(), 1, inbuf.size(), f);
+		in.pos = 0;
+		if (in.size >= 4 && inbuf[0] == 0x28 && inbuf[1] == 0xb5 && inbuf[2] == 0x2f && inbuf[3] == 0xfd) {
+			format = FMT_ZSTD;
+			dctx = ZSTD_createDCtx();
+			fill();
+		} else {
+			format = in.size >= 8 && !memcmp(inbuf.data(), TRACE_MAGIC, 8) ? FMT_BINARY : FMT_TEXT;
+			memcpy(buf.data(), inbuf.data(), in.size);
+			len = in.size;
+			in.pos = in.size;
+		}
+		if (format != FMT_TEXT) {
+			if (len < 8 || memcmp(buf.data(), TRACE_MAGIC, 8)) {
+				fprintf(stderr, "%s: not a trace file.\n", filename);
+				return false;
+			}
+			pos = 8;
+		}
+		return true;
+	}
+
+	// Refill buf, keeping the unconsumed bytes at the start. Returns false at end of file.
+	bool fill()
+	{
+		if (eof)
+			return false;
+		memmove(buf.data(), buf.data() + pos, len - pos);
+		len -= pos;
+		pos = 0;
+		size_t before = len;
+		while (len == before) {
+			if (in.pos == in.size && !in_eof) {
+				in.size = fread(inbuf.data(), 1, inbuf.size(), f);
+				in.pos = 0;
+				in_eof = in.size == 0;
+			}
+			if (format == FMT_ZSTD) {
+				// The decompressor can hold back output when buf is full, so keep
+				// calling it after the input is used up until it produces nothing.
+				ZSTD_outBuffer out = { buf.data() + len, buf.size() - len, 0 };
+				size_t in_pos = in.pos;
+				size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+				if (ZSTD_isError(ret)) {
+					fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+					eof = true;
+					return false;
+				}
+				len += out.pos;
+				if (out.pos != 0 || in.pos != in_pos)
+					zstd_ret = ret;
+				if (in_eof && out.pos == 0) {
+					// 0 if the last frame was complete and fully flushed
+					if (zstd_ret != 0)
+						fprintf(stderr, "zstd: truncated input\n");
+					eof = true;
+					return false;
+				}
+			} else {
+				if (in_eof) {
+					eof = true;
+					return false;
+				}
+				size_t n = std::min(in.size - in.pos, buf.size() - len);
+				memcpy(buf.data() + len, inbuf.data() + in.pos, n);
+				in.pos += n;
+				len += n;
+			}
+		}
+		return true;
+	}
+
+	bool read(uint64_t &trace_data)
+	{
+		while (1) {
+			if (format == FMT_TEXT) {
+				uint8_t *nl = (uint8_t*)memchr(buf.data() + pos, '\n', len - pos);
+				if (nl != NULL || (eof && pos < len)) {
+					uint8_t *end = nl ? nl : buf.data() + len;
+					if (end == buf.data() + pos) {
+						pos++;
+						continue;
+					}
+					trace_data = 0;
+					for (uint8_t *p = buf.data() + pos; p < end; p++) {
+						int c = *p;
+						if (c >= '0' && c <= '9') trace_data = trace_data << 4 | (c - '0');
+						else if (c >= 'a' && c <= 'f') trace_data = trace_data << 4 | (c - 'a' + 10);
+						else if (c >= 'A' && c <= 'F') trace_data = trace_data << 4 | (c - 'A' + 10);
+						else if (c == 'x' || c == 'X') trace_data = trace_data << 4;
+					}
+					pos = end - buf.data() + (nl != NULL);
+					return true;
+				}
+			} else {
+				int n = codec.decode(buf.data() + pos, len - pos, trace_data);
+				if (n > 0) {
+					pos += n;
+					return true;
+				}
+			}
+			if (!fill())
+				return format == FMT_TEXT && pos < len ? read(trace_data) : false;
+		}
+	}
+
+	void close()
+	{
+		if (dctx != NULL)
+			ZSTD_freeDCtx(dctx);
+		if (f != NULL && f != stdin)
+			fclose(f);
+		dctx = NULL;
+		f = NULL;
+	}
+};
+
+#endif
@@ -0,0 +1,101 @@
+// Background writer thread for the Verilator test bench output files.
+//
+// The simulation thread appends data to one of two buffers. When that buffer
+// is full it is handed to the writer thread by setting an atomic flag, and the
+// simulation continues with the other buffer. The writer thread passes each
+// full buffer to the sink function (write to disk, format, compress) and then
+// clears the flag. The simulation only waits if the writer falls behind by a
+// whole buffer.
+
+#ifndef TESTBENCH_WRITER_H
+#define TESTBENCH_WRITER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+struct async_writer
+{
+	typedef std::function<void(const uint8_t *data, size_t len)> sink_t;
+
+	sink_t sink;
+	std::vector<uint8_t> buf[2];
+	size_t len[2];
+	std::atomic<bool> full[2];
+	std::atomic<bool> done;
+	int cur;
+	std::thread thread;
+
+	// bufsize should be a multiple of the record size if the sink expects whole records
+	async_writer(sink_t sink, size_t bufsize = 1 << 20) : sink(sink), done(false), cur(0)
+	{
+		for (int i = 0; i < 2; i++) {
+			buf[i].resize(bufsize);
+			len[i] = 0;
+			full[i] = false;
+		}
+		thread = std::thread(&async_writer::run, this);
+	}
+
+	~async_writer() { finish(); }
+
+	void put(const void *data, size_t n)
+	{
+		const uint8_t *p = (const uint8_t*)data;
+		while (n > 0) {
+			size_t k = std::min(n, buf[cur].size() - len[cur]);
+			memcpy(buf[cur].data() + len[cur], p, k);
+			len[cur] += k;
+			p += k;
+			n -= k;
+			if (len[cur] == buf[cur].size())
+				flush();
+		}
+	}
+
+	// Hand the current buffer to the writer thread and wait until the other one is free.
+	void flush()
+	{
+		if (len[cur] == 0)
+			return;
+		full[cur].store(true, std::memory_order_release);
+		cur ^= 1;
+		while (full[cur].load(std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+
+	// Write out everything and stop the writer thread.
+	void finish()
+	{
+		if (!thread.joinable())
+			return;
+		flush();
+		done.store(true, std::memory_order_release);
+		thread.join();
+	}
+
+	void run()
+	{
+		int i = 0;
+		while (1) {
+			bool stop = done.load(std::memory_order_acquire);
+			if (full[i].load(std::memory_order_acquire)) {
+				sink(buf[i].data(), len[i]);
+				len[i] = 0;
+				full[i].store(false, std::memory_order_release);
+				i ^= 1;
+			} else if (stop) {
+				break;
+			} else {
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		}
+	}
+};
+
+#endif